@@ -1,9 +1,10 @@
 #include "bandit.h"
+#include "utils.h"
 
 Bandit::Bandit(const unsigned int numberOfArms,
 	const unsigned int rewardBufferSize) : playIndex(0), numberOfArms(numberOfArms), rewardBufferSize(rewardBufferSize)
 {
-	for (int index = 0; index < numberOfArms; index++) 
+	for (unsigned int index = 0; index < numberOfArms; index++) 
 	{
 		arms.push_back(new Arm(rewardBufferSize));
 		actions.push_back(index);
@@ -12,7 +13,7 @@ Bandit::Bandit(const unsigned int numberOfArms,
 
 Bandit::~Bandit() 
 {
-	for (int index = 0; index < arms.size(); index++) 
+	for (int index = 0; index < (int) arms.size(); index++) 
 	{
 		delete arms[index];
 	}
@@ -21,20 +22,25 @@ Bandit::~Bandit()
 int Bandit::play() 
 {
 	actionPlayCandidates.clear();
-	for (int index = 0; index < actions.size(); index++)
+	for (int index = 0; index < (int) actions.size(); index++)
 	{
 		if (getArm(index)->size() > 0)
 		{
 			actionPlayCandidates.push_back(index);
 		}
 	}
+	// No arm has been played yet
+	if (actionPlayCandidates.empty())
+	{
+		return -1;
+	}
 	return play(actionPlayCandidates);
 }
 
 int Bandit::play(const std::vector<int>& legalArms)
 {
 	means.clear();
-	for (int index = 0; index < legalArms.size(); index++)
+	for (int index = 0; index < (int) legalArms.size(); index++)
 	{
 		means.push_back(arms[legalArms[index]]->mean());
 	}
@@ -109,9 +115,9 @@ ThompsonSampling::ThompsonSampling(
 	const unsigned int numberOfArms,
 	const unsigned int rewardBufferSize,
     	const unsigned int updateDelay,
-	const unsigned int beta0) : Bandit(numberOfArms, rewardBufferSize), lambda(0), rewardBufferSize(rewardBufferSize), updateDelay(updateDelay), beta0(beta0)
+	const unsigned int beta0) : Bandit(numberOfArms, rewardBufferSize), beta0(beta0), lambda(0), updateDelay(updateDelay), rewardBufferSize(rewardBufferSize), generator(UTILS::RandomInt())
 {
-	for (int index = 0; index < numberOfArms; index++)
+	for (unsigned int index = 0; index < numberOfArms; index++)
 	{
 		means.push_back(0);
 		vars.push_back(0);
@@ -155,7 +161,6 @@ int ThompsonSampling::sampleArmFrom(const std::vector<int>& legalArms)
 {
 	sampledMeans.clear();
 	int numberOfArms = legalArms.size();
-	int rewardBufferSize = getRewardBufferSize();
 	for (int index = 0; index < numberOfArms; index++)
 	{
 		int armIndex = legalArms[index];
@@ -189,3 +194,120 @@ int ThompsonSampling::sampleArmFrom(const std::vector<int>& legalArms)
 	}
 	return legalArms[argmax(sampledMeans)];
 }
+
+int TopTwoThompsonSampling::sampleArmFrom(const std::vector<int>& legalArms)
+{
+	int leader = ThompsonSampling::sampleArmFrom(legalArms);
+	if (legalArms.size() < 2 || randomDouble() < leaderProbability)
+	{
+		return leader;
+	}
+	for (int attempt = 0; attempt < 100; attempt++)
+	{
+		int challenger = ThompsonSampling::sampleArmFrom(legalArms);
+		if (challenger != leader)
+		{
+			return challenger;
+		}
+	}
+	return leader;
+}
+
+int SequentialHalving::sampleArmFrom(const std::vector<int>& legalArms)
+{
+	if (survivors.empty())
+	{
+		survivors = legalArms;
+		numberOfRounds = 1;
+		while ((1u << numberOfRounds) < survivors.size())
+		{
+			numberOfRounds++;
+		}
+		roundBudget = std::max<int>(budget / numberOfRounds, survivors.size());
+		roundPlays = 0;
+		next = 0;
+	}
+	else if (roundPlays >= roundBudget && survivors.size() > 1)
+	{
+		halve();
+	}
+	roundPlays++;
+	int arm = survivors[next];
+	next = (next + 1) % survivors.size();
+	return arm;
+}
+
+void SequentialHalving::halve()
+{
+	std::vector<std::pair<double, int> > ranked;
+	for (int index = 0; index < (int) survivors.size(); index++)
+	{
+		ranked.push_back(std::make_pair(-getArm(survivors[index])->mean(), survivors[index]));
+	}
+	std::stable_sort(ranked.begin(), ranked.end());
+	survivors.resize((survivors.size() + 1) / 2);
+	for (int index = 0; index < (int) survivors.size(); index++)
+	{
+		survivors[index] = ranked[index].second;
+	}
+	roundPlays = 0;
+	next = 0;
+}
+
+int SequentialHalving::play()
+{
+	if (survivors.empty())
+	{
+		return Bandit::play();
+	}
+	return Bandit::play(survivors);
+}
+
+void SequentialHalving::reset()
+{
+	Bandit::reset();
+	survivors.clear();
+}
+
+void Bandit::UnitTest()
+{
+	UTILS::RANDOM_STREAM stream(1);
+
+	// Ties are broken at random, the best value always wins
+	RandomBandit random(3);
+	std::vector<double> values = { 1, 3, 3 };
+	int ties[3] = { 0, 0, 0 };
+	for (int i = 0; i < 1000; i++)
+		ties[random.argmax(values)]++;
+	assert(ties[0] == 0 && ties[1] > 0 && ties[2] > 0);
+
+	// Nothing to recommend before any arm is played
+	assert(random.play() == -1);
+
+	// Halving keeps the best arm, however the budget divides
+	std::vector<int> legal = { 0, 1, 2, 3, 4 };
+	SequentialHalving halving(5, 1, 40);
+	for (int i = 0; i < 40; i++)
+	{
+		int arm = halving.sampleFrom(legal);
+		halving.update(arm == 3 ? 1 : 0);
+	}
+	assert(halving.play() == 3);
+
+	// Top-two plays the leader with probability leaderProbability, so the
+	// better arm is played more often the larger it is
+	std::vector<int> pair = { 0, 1 };
+	int best[2] = { 0, 0 };
+	for (int t = 0; t < 2; t++)
+	{
+		TopTwoThompsonSampling topTwo(2, 1, 1, t == 0 ? 0.1 : 0.9);
+		for (int i = 0; i < 20; i++)
+		{
+			topTwo.sampleFrom(pair);
+			topTwo.update(topTwo.currentPlayIndex() == 0 ? UTILS::RandomDouble(0.5, 1) : UTILS::RandomDouble(0, 0.5));
+		}
+		for (int i = 0; i < 1000; i++)
+			best[t] += topTwo.sampleArmFrom(pair) == 0;
+	}
+	assert(best[1] > best[0] + 200);
+}
@@ -1,3 +1,4 @@
+#pragma once
 #include <vector>
 #include <numeric>
 #include <algorithm>
@@ -16,7 +17,7 @@ class Arm
 public:
 	Arm(const unsigned int capacity) : count(0), capacity(capacity)
 	{
-		for (int index = 0; index < capacity + 1; index++)
+		for (unsigned int index = 0; index < capacity + 1; index++)
         {
 			lastEstimatedValues.push_back(0);
 		}
@@ -38,21 +39,21 @@ public:
 		squaredValue += reward*reward;
 	}
     
-    const bool hasConverged(const double epsilon)
+    bool hasConverged(const double epsilon)
     {
         if(count < capacity + 1)
         {
             return false;
         }
         double deltaSum = 0.0;
-        for(int index = 1; index < capacity + 1; index++)
+        for(unsigned int index = 1; index < capacity + 1; index++)
         {
             deltaSum += std::abs(lastEstimatedValues[index]-lastEstimatedValues[index-1]);
         }
         return deltaSum/capacity < epsilon;
     }
 
-	const double mean() 
+	double mean() 
 	{
 	        if(count == 0)
 		{
@@ -68,7 +69,7 @@ public:
 		count = newCount;
 	}
 
-	const double std() 
+	double std() 
 	{
 		double mean = this->mean();
 		if (count == 0) {
@@ -84,7 +85,7 @@ public:
 		return res;
 	}
 
-	const unsigned int size() const
+	unsigned int size() const
 	{
 		return count;
 	}
@@ -125,7 +126,7 @@ public:
 	virtual int sampleArmFrom(const std::vector<int>& legalArms) = 0;
 	int sampleFrom(const std::vector<int>& legalArms);
 	virtual void update(const double reward);
-	const unsigned int getNumberOfArms() 
+	unsigned int getNumberOfArms() 
 	{
 		return numberOfArms;
 	}
@@ -133,7 +134,7 @@ public:
 	{
 		return arms[index];
 	}
-    const bool hasConverged(const double epsilon)
+    bool hasConverged(const double epsilon)
     {
         if (playIndex >= 0) 
         {
@@ -143,7 +144,6 @@ public:
     }
 	int argmax(std::vector<double>& data) 
 	{
-		static std::vector<int> candidateValueIndices;
 		candidateValueIndices.clear();
 		double bestValue = -std::numeric_limits<double>::infinity();
 		int n = data.size();
@@ -172,10 +172,12 @@ public:
 		}
 	}
 
-	const unsigned int getRewardBufferSize() const {
+	unsigned int getRewardBufferSize() const {
 		return rewardBufferSize;
 	}
 
+	static void UnitTest();
+
 private:
 	int playIndex;
 	const unsigned int numberOfArms;
@@ -184,6 +186,7 @@ private:
 	std::vector<double> means;
 	std::vector<int> actions;
 	std::vector<int> actionPlayCandidates;
+	std::vector<int> candidateValueIndices;
 };
 
 class RandomBandit : public Bandit 
@@ -257,3 +260,44 @@ private:
 	std::vector<double> means;
 	std::vector<double> vars;
 };
+
+// Top-two Thompson sampling: plays the Thompson leader with probability
+// leaderProbability, otherwise a challenger drawn by resampling until the
+// leader changes
+class TopTwoThompsonSampling : public ThompsonSampling
+{
+public:
+	TopTwoThompsonSampling(
+		const unsigned int numberOfArms,
+		const unsigned int rewardBufferSize,
+		const unsigned int beta0,
+		double leaderProbability = 0.5) : ThompsonSampling(numberOfArms, rewardBufferSize, 1, beta0), leaderProbability(leaderProbability) {}
+	virtual ~TopTwoThompsonSampling() {}
+	virtual int sampleArmFrom(const std::vector<int>& legalArms);
+private:
+	const double leaderProbability;
+};
+
+// Sequential halving over a fixed budget of plays: arms are played round
+// robin, and after each of ceil(log2(arms)) rounds the worse half is dropped
+class SequentialHalving : public Bandit
+{
+public:
+	SequentialHalving(
+		const unsigned int numberOfArms,
+		const unsigned int rewardBufferSize,
+		const unsigned int budget) : Bandit(numberOfArms, rewardBufferSize), budget(budget), roundPlays(0), next(0) {}
+	virtual ~SequentialHalving() {}
+	virtual int sampleArmFrom(const std::vector<int>& legalArms);
+	// Best surviving arm
+	virtual int play();
+	virtual void reset();
+private:
+	void halve();
+	const unsigned int budget;
+	std::vector<int> survivors;
+	int numberOfRounds;
+	int roundBudget;
+	int roundPlays;
+	int next;
+};
@@ -1,6 +1,7 @@
 #include "beliefstate.h"
 #include "simulator.h"
 #include "utils.h"
+#include <unordered_map>
 
 using namespace UTILS;
 
@@ -17,34 +18,125 @@ void BELIEF_STATE::Free(const SIMULATOR& simulator)
 		simulator.FreeState(*i_state);
 	}
 	Samples.clear();
+	Counts.clear();
+	Cumulative.clear();
+	Analytic.reset();
 }
 
 STATE* BELIEF_STATE::CreateSample(const SIMULATOR& simulator) const
 {
-	int index = Random(Samples.size());
-	return simulator.Copy(*Samples[index]);
+	if (Analytic)
+		return Analytic->CreateSample(simulator);
+	return simulator.Copy(*Samples[SampleIndex()]);
+}
+
+bool BELIEF_STATE::SampleInto(const SIMULATOR& simulator, STATE& target) const
+{
+	if (Analytic)
+		return false;
+	return simulator.CopyInto(*Samples[SampleIndex()], target);
+}
+
+int BELIEF_STATE::SampleIndex() const
+{
+	if (Counts.empty())
+		return Random(Samples.size());
+
+	// Sample unique states in proportion to their multiplicities
+	int particle = Random(Cumulative.back());
+	return std::upper_bound(Cumulative.begin(), Cumulative.end(), particle)
+		- Cumulative.begin();
 }
 
 void BELIEF_STATE::AddSample(STATE* state)
 {
 	Samples.push_back(state);
+	if (!Counts.empty())
+	{
+		Counts.push_back(1);
+		Cumulative.push_back(Cumulative.back() + 1);
+	}
+}
+
+void BELIEF_STATE::AddSample(STATE* state, int count)
+{
+	if (Counts.empty())
+	{
+		Counts.assign(Samples.size(), 1);
+		Cumulative.resize(Samples.size());
+		std::partial_sum(Counts.begin(), Counts.end(), Cumulative.begin());
+	}
+	Samples.push_back(state);
+	Counts.push_back(count);
+	Cumulative.push_back((Cumulative.empty() ? 0 : Cumulative.back()) + count);
 }
 
 void BELIEF_STATE::Copy(const BELIEF_STATE& beliefs, const SIMULATOR& simulator)
 {
-	for (std::vector<STATE*>::const_iterator i_state = beliefs.Samples.begin();
-		i_state != beliefs.Samples.end(); ++i_state)
+	for (int i = 0; i < beliefs.GetNumSamples(); ++i)
 	{
-		AddSample(simulator.Copy(**i_state));
+		STATE* state = simulator.Copy(*beliefs.Samples[i]);
+		if (beliefs.Counts.empty())
+			AddSample(state);
+		else
+			AddSample(state, beliefs.Counts[i]);
 	}
+	if (beliefs.Analytic)
+		Analytic = beliefs.Analytic;
 }
 
 void BELIEF_STATE::Move(BELIEF_STATE& beliefs)
 {
-	for (std::vector<STATE*>::const_iterator i_state = beliefs.Samples.begin();
-		i_state != beliefs.Samples.end(); ++i_state)
+	for (int i = 0; i < beliefs.GetNumSamples(); ++i)
 	{
-		AddSample(*i_state);
+		if (beliefs.Counts.empty())
+			AddSample(beliefs.Samples[i]);
+		else
+			AddSample(beliefs.Samples[i], beliefs.Counts[i]);
 	}
 	beliefs.Samples.clear();
+	beliefs.Counts.clear();
+	beliefs.Cumulative.clear();
+	if (beliefs.Analytic)
+		Analytic.swap(beliefs.Analytic);
+	beliefs.Analytic.reset();
+}
+
+void BELIEF_STATE::Compact(const SIMULATOR& simulator)
+{
+	std::size_t hash;
+	if (Samples.empty() || !simulator.HashState(*Samples[0], hash))
+		return;
+
+	std::vector<STATE*> samples;
+	std::vector<int> counts;
+	std::unordered_multimap<std::size_t, int> unique;
+	samples.swap(Samples);
+	counts.swap(Counts);
+
+	for (int i = 0; i < (int) samples.size(); ++i)
+	{
+		int count = counts.empty() ? 1 : counts[i];
+		simulator.HashState(*samples[i], hash);
+		auto range = unique.equal_range(hash);
+		auto i_match = range.first;
+		for (; i_match != range.second; ++i_match)
+			if (simulator.EqualStates(*Samples[i_match->second], *samples[i]))
+				break;
+
+		if (i_match != range.second)
+		{
+			Counts[i_match->second] += count;
+			simulator.FreeState(samples[i]);
+		}
+		else
+		{
+			unique.insert(std::make_pair(hash, (int) Samples.size()));
+			Samples.push_back(samples[i]);
+			Counts.push_back(count);
+		}
+	}
+
+	Cumulative.resize(Counts.size());
+	std::partial_sum(Counts.begin(), Counts.end(), Cumulative.begin());
 }
@@ -2,10 +2,28 @@
 #define BELIEF_STATE_H
 
 #include <vector>
+#include <memory>
 
 class STATE;
 class SIMULATOR;
 
+// Closed-form belief maintained by the simulator instead of particles
+class ANALYTIC_BELIEF
+{
+public:
+
+	virtual ~ANALYTIC_BELIEF() { }
+
+	// Creates new state drawn from the belief, now owned by caller
+	virtual STATE* CreateSample(const SIMULATOR& simulator) const = 0;
+
+	// Bayes update on the real action, observation and reward
+	virtual void Update(int action, int observation,
+		const std::vector<double>& reward) = 0;
+
+	virtual ANALYTIC_BELIEF* Clone() const = 0;
+};
+
 class BELIEF_STATE
 {
 public:
@@ -18,22 +36,49 @@ public:
 	// Creates new state, now owned by caller
 	STATE* CreateSample(const SIMULATOR& simulator) const;
 
+	// Particle to simulate on in place, still owned by belief state
+	STATE* SelectSample() { return Samples[SampleIndex()]; }
+
+	// Overwrites target with a sampled particle instead of allocating one.
+	// Returns false for closed-form beliefs or if the simulator cannot
+	bool SampleInto(const SIMULATOR& simulator, STATE& target) const;
+
 	// Added state is owned by belief state
 	void AddSample(STATE* state);
 
+	// Added state is owned by belief state and stands for count particles
+	void AddSample(STATE* state, int count);
+
 	// Make own copies of all samples
 	void Copy(const BELIEF_STATE& beliefs, const SIMULATOR& simulator);
 
 	// Move all samples into this belief state
 	void Move(BELIEF_STATE& beliefs);
 
-	bool Empty() const { return Samples.empty(); }
+	// Merge identical samples into unique states with multiplicities
+	// (requires simulator state hashing, otherwise does nothing)
+	void Compact(const SIMULATOR& simulator);
+
+	// Draw samples from a closed-form belief instead of the particles
+	void SetAnalytic(ANALYTIC_BELIEF* analytic) { Analytic.reset(analytic); }
+	const ANALYTIC_BELIEF* GetAnalytic() const { return Analytic.get(); }
+
+	bool Empty() const { return Samples.empty() && !Analytic; }
 	int GetNumSamples() const { return Samples.size(); }
 	const STATE* GetSample(int index) const { return Samples[index]; }
 
+	// Number of particles represented by a sample, and in total
+	int GetCount(int index) const { return Counts.empty() ? 1 : Counts[index]; }
+	int GetNumParticles() const { return Counts.empty() ? Samples.size() : Cumulative.back(); }
+
 private:
 
+	int SampleIndex() const;
+
 	std::vector<STATE*> Samples;
+	std::vector<int> Counts;     // empty unless compacted
+	std::vector<int> Cumulative; // running total of Counts
+	std::shared_ptr<ANALYTIC_BELIEF> Analytic;
 };
 
 #endif // BELIEF_STATE_H
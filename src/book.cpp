@@ -0,0 +1,223 @@
+#include "book.h"
+#include "node.h"
+#include "utils.h"
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+
+using namespace std;
+
+static const char BookMagic[8] = { 'P', 'O', 'M', 'C', 'P', 'B', 'K', '1' };
+
+bool OPENING_BOOK::Save(const string& filename, const VNODE* root,
+	int maxDepth, bool openLoop)
+{
+	// Written aside and renamed, so a process that has the old book mapped
+	// keeps reading it intact
+	string tempFile = filename + ".tmp";
+	ofstream ofs(tempFile.c_str(), ios::binary);
+	Write(ofs, root, maxDepth, openLoop);
+	ofs.close();
+	return ofs.good() && rename(tempFile.c_str(), filename.c_str()) == 0;
+}
+
+void OPENING_BOOK::Write(ostream& ostr, const VNODE* root,
+	int maxDepth, bool openLoop)
+{
+	vector<ACTION_RECORD> actions;
+	vector<CHILD_RECORD> children;
+	Append(root, 0, maxDepth, actions, children);
+
+	HEADER header;
+	memcpy(header.Magic, BookMagic, sizeof(header.Magic));
+	header.NumActions = VNODE::NumChildren;
+	header.NumObservations = QNODE::NumChildren;
+	header.NumNodes = actions.size() / VNODE::NumChildren;
+	header.NumChildren = children.size();
+	header.OpenLoop = openLoop;
+	header.Pad = 0;
+
+	ostr.write((const char*) &header, sizeof(header));
+	ostr.write((const char*) actions.data(), actions.size() * sizeof(ACTION_RECORD));
+	ostr.write((const char*) children.data(), children.size() * sizeof(CHILD_RECORD));
+}
+
+int OPENING_BOOK::Append(const VNODE* vnode, int depth, int maxDepth,
+	vector<ACTION_RECORD>& actions, vector<CHILD_RECORD>& children)
+{
+	int node = actions.size() / VNODE::NumChildren;
+	int first = actions.size();
+	actions.resize(first + VNODE::NumChildren);
+
+	for (int action = 0; action < VNODE::NumChildren; action++)
+	{
+		const QNODE& qnode = vnode->Child(action);
+		ACTION_RECORD record;
+		// Illegal actions carry a sentinel count and value, leave them out
+		int count = qnode.Value.GetCount();
+		vector<double> mean = qnode.Value.GetValue();
+		bool valid = count > 0 && count < LargeInteger;
+		record.Count = valid ? count : 0;
+		for (int i = 0; i < 2; i++)
+			record.Total[i] = valid ? mean[i] * count : 0.0;
+		record.FirstChild = children.size();
+		record.NumChildren = 0;
+		record.Illegal = count >= LargeInteger;
+
+		// Reserve the child block before descending, so that it stays contiguous
+		if (valid && depth + 1 < maxDepth)
+		{
+			for (int observation = 0; observation < QNODE::NumChildren; observation++)
+				if (qnode.Child(observation))
+					record.NumChildren++;
+			children.resize(children.size() + record.NumChildren);
+			int c = record.FirstChild;
+			for (int observation = 0; observation < QNODE::NumChildren; observation++)
+			{
+				if (!qnode.Child(observation))
+					continue;
+				int child = Append(qnode.Child(observation), depth + 1, maxDepth, actions, children);
+				children[c].Observation = observation;
+				children[c].Node = child;
+				c++;
+			}
+		}
+		actions[first + action] = record;
+	}
+	return node;
+}
+
+OPENING_BOOK* OPENING_BOOK::Open(const string& filename,
+	int numActions, int numObservations, bool openLoop)
+{
+	std::unique_ptr<MAPPED_FILE> file(new MAPPED_FILE);
+	if (!file->Open(filename))
+	{
+		cout << "Cannot map book " << filename << endl;
+		return 0;
+	}
+	OPENING_BOOK* book = Attach(file->GetData(), file->GetSize(),
+		numActions, numObservations, openLoop);
+	if (!book)
+	{
+		cout << "Book " << filename << " does not match this problem" << endl;
+		return 0;
+	}
+	book->Filename = filename;
+	book->File = std::move(file);
+	return book;
+}
+
+OPENING_BOOK* OPENING_BOOK::Attach(const char* data, std::size_t size,
+	int numActions, int numObservations, bool openLoop)
+{
+	if (size < sizeof(HEADER))
+		return 0;
+	const HEADER& header = *(const HEADER*) data;
+	std::size_t expected = sizeof(HEADER)
+		+ (std::size_t) header.NumNodes * header.NumActions * sizeof(ACTION_RECORD)
+		+ (std::size_t) header.NumChildren * sizeof(CHILD_RECORD);
+	if (memcmp(header.Magic, BookMagic, sizeof(BookMagic)) != 0
+		|| header.NumActions != numActions || header.NumObservations != numObservations
+		|| header.OpenLoop != openLoop || header.NumNodes < 1 || header.NumChildren < 0
+		|| size != expected)
+		return 0;
+
+	OPENING_BOOK* book = new OPENING_BOOK;
+	book->Header = &header;
+	book->Actions = (const ACTION_RECORD*) (book->Header + 1);
+	book->Children = (const CHILD_RECORD*) (book->Actions
+		+ (std::size_t) header.NumNodes * header.NumActions);
+
+	// Find and Build follow the stored indices unchecked, so reject any that
+	// leave the arrays
+	for (int i = 0; i < header.NumNodes * header.NumActions; i++)
+	{
+		const ACTION_RECORD& record = book->Actions[i];
+		bool valid = record.Count >= 0 && record.NumChildren >= 0
+			&& record.FirstChild >= 0 && record.FirstChild <= header.NumChildren
+			&& record.NumChildren <= header.NumChildren - record.FirstChild;
+		for (int c = 0; valid && c < record.NumChildren; c++)
+		{
+			const CHILD_RECORD& child = book->Children[record.FirstChild + c];
+			valid = child.Observation >= 0 && child.Observation < header.NumObservations
+				&& child.Node > i / header.NumActions && child.Node < header.NumNodes
+				&& (c == 0 || child.Observation > book->Children[record.FirstChild + c - 1].Observation);
+		}
+		if (!valid)
+		{
+			delete book;
+			return 0;
+		}
+	}
+	return book;
+}
+
+int OPENING_BOOK::Find(const HISTORY& history) const
+{
+	int node = 0;
+	for (int t = 0; t < history.Size(); ++t)
+	{
+		const ACTION_RECORD& record = Actions[node * Header->NumActions + history[t].Action];
+		int observation = Header->OpenLoop ? 0 : history[t].Observation;
+		const CHILD_RECORD* first = Children + record.FirstChild;
+		const CHILD_RECORD* last = first + record.NumChildren;
+		const CHILD_RECORD* child = lower_bound(first, last, observation,
+			[](const CHILD_RECORD& c, int obs) { return c.Observation < obs; });
+		if (child == last || child->Observation != observation)
+			return -1;
+		node = child->Node;
+	}
+	return node;
+}
+
+void OPENING_BOOK::Apply(int node, VNODE* root) const
+{
+	vector<double> mean(2);
+	for (int action = 0; action < Header->NumActions; action++)
+	{
+		const ACTION_RECORD& record = Actions[node * Header->NumActions + action];
+		if (record.Count == 0)
+			continue;
+		for (int i = 0; i < 2; i++)
+			mean[i] = record.Total[i] / record.Count;
+		root->Child(action).Value.Add(mean, record.Count);
+	}
+}
+
+VNODE* OPENING_BOOK::Build(int node) const
+{
+	VNODE* vnode = VNODE::Create();
+	vnode->Value.Set(0, 0);
+	vector<double> mean(2);
+	int total = 0;
+	for (int action = 0; action < Header->NumActions; action++)
+	{
+		const ACTION_RECORD& record = Actions[node * Header->NumActions + action];
+		QNODE& qnode = vnode->Child(action);
+		qnode.AMAF.Set(0, 0);
+		if (record.Illegal)
+		{
+			qnode.Value.Set(+LargeInteger, -Infinity);
+			continue;
+		}
+		qnode.Value.Set(0, 0);
+		if (record.Count > 0)
+		{
+			for (int i = 0; i < 2; i++)
+				mean[i] = record.Total[i] / record.Count;
+			qnode.Value.Add(mean, record.Count);
+			total += record.Count;
+		}
+		for (int c = 0; c < record.NumChildren; c++)
+		{
+			const CHILD_RECORD& child = Children[record.FirstChild + c];
+			qnode.Child(child.Observation) = Build(child.Node);
+		}
+	}
+	// Node visits are not stored, the action visits stand in for them
+	vnode->Value.Set(total, 0);
+	return vnode;
+}
+
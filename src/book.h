@@ -0,0 +1,88 @@
+#ifndef BOOK_H
+#define BOOK_H
+
+#include "history.h"
+#include "mappedfile.h"
+#include <string>
+#include <ostream>
+#include <vector>
+#include <cstdint>
+#include <memory>
+
+class VNODE;
+
+// Searched tree stored without particles as flat pre-order arrays:
+// NumActions action records per node, each pointing at a sorted block of
+// (observation, node) child records. Node 0 is the root of the episode
+class OPENING_BOOK
+{
+public:
+
+	struct HEADER
+	{
+		char Magic[8];
+		std::int32_t NumActions;
+		std::int32_t NumObservations;
+		std::int32_t NumNodes;
+		std::int32_t NumChildren;
+		std::int32_t OpenLoop;
+		std::int32_t Pad;
+	};
+
+	struct ACTION_RECORD
+	{
+		double Total[2];
+		std::int32_t Count;
+		std::int32_t FirstChild;
+		std::int32_t NumChildren;
+		std::int32_t Illegal;
+	};
+
+	struct CHILD_RECORD
+	{
+		std::int32_t Observation;
+		std::int32_t Node;
+	};
+
+	// Write the first maxDepth levels of the tree below root
+	static bool Save(const std::string& filename, const VNODE* root,
+		int maxDepth, bool openLoop);
+	static void Write(std::ostream& ostr, const VNODE* root,
+		int maxDepth, bool openLoop);
+
+	// Memory-map a saved book read-only, 0 if it cannot be used
+	static OPENING_BOOK* Open(const std::string& filename,
+		int numActions, int numObservations, bool openLoop);
+
+	// Book stored in memory owned by the caller, 0 if it cannot be used
+	static OPENING_BOOK* Attach(const char* data, std::size_t size,
+		int numActions, int numObservations, bool openLoop);
+
+	// Node reached by the history, taking observations as tree child
+	// indices, or -1 if the book does not cover it
+	int Find(const HISTORY& history) const;
+
+	// Add the book's action statistics at node to the root's
+	void Apply(int node, VNODE* root) const;
+
+	// Rebuild the stored subtree below node as search tree nodes
+	VNODE* Build(int node) const;
+
+	const std::string& GetFilename() const { return Filename; }
+	int GetNumNodes() const { return Header->NumNodes; }
+
+private:
+
+	OPENING_BOOK() { }
+
+	static int Append(const VNODE* vnode, int depth, int maxDepth,
+		std::vector<ACTION_RECORD>& actions, std::vector<CHILD_RECORD>& children);
+
+	std::string Filename;
+	std::unique_ptr<MAPPED_FILE> File;
+	const HEADER* Header;
+	const ACTION_RECORD* Actions;
+	const CHILD_RECORD* Children;
+};
+
+#endif // BOOK_H
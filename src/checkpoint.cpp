@@ -0,0 +1,340 @@
+#include "checkpoint.h"
+#include "mcts.h"
+#include "book.h"
+#include "mappedfile.h"
+#include "testsimulator.h"
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+
+using namespace std;
+
+static const char EpisodeMagic[8] = { 'P', 'O', 'M', 'C', 'P', 'E', 'P', '1' };
+
+// Sections are padded to 8 bytes so that the tree can be used in place
+static void Pad(ostream& ostr)
+{
+	static const char zeros[8] = { 0 };
+	streamoff pos = ostr.tellp();
+	if (pos % 8)
+		ostr.write(zeros, 8 - pos % 8);
+}
+
+static size_t Padded(size_t size)
+{
+	return (size + 7) & ~(size_t) 7;
+}
+
+CHECKPOINT::CHECKPOINT(const string& prefix, const SIMULATOR& real,
+	const SIMULATOR& simulator)
+	: RunsFile(prefix + ".runs"),
+	EpisodeFile(prefix + ".episode"),
+	Real(real),
+	Simulator(simulator)
+{
+}
+
+void CHECKPOINT::LoadRuns(int doubles, vector<RUN>& runs) const
+{
+	MAPPED_FILE file;
+	if (!file.Open(RunsFile))
+		return;
+
+	// A record cut short by a crash ends the replay
+	const char* data = file.GetData();
+	const char* end = data + file.GetSize();
+	while (data + sizeof(RUN_RECORD) <= end)
+	{
+		RUN_RECORD record;
+		memcpy(&record, data, sizeof(record));
+		size_t rewardSize = record.NumRewards * 2 * sizeof(double);
+		if (data + sizeof(record) + rewardSize > end)
+			break;
+		if (record.Doubles == doubles)
+		{
+			RUN run;
+			run.Doubles = record.Doubles;
+			run.Run = record.Run;
+			run.Time = record.Time;
+			run.Timestep = record.Timestep;
+			run.GGFScore = record.GGFScore;
+			run.UndiscountedCV = record.UndiscountedCV;
+			run.DiscountedCV = record.DiscountedCV;
+			run.Undiscounted.assign(record.Undiscounted, record.Undiscounted + 2);
+			run.Discounted.assign(record.Discounted, record.Discounted + 2);
+			const double* rewards = (const double*) (data + sizeof(record));
+			run.Rewards.resize(record.NumRewards);
+			for (int t = 0; t < record.NumRewards; t++)
+				run.Rewards[t].assign(rewards + 2 * t, rewards + 2 * t + 2);
+			runs.push_back(run);
+		}
+		data += sizeof(record) + rewardSize;
+	}
+}
+
+void CHECKPOINT::AddRun(const RUN& run)
+{
+	RUN_RECORD record;
+	record.Doubles = run.Doubles;
+	record.Run = run.Run;
+	record.NumRewards = run.Rewards.size();
+	record.Pad = 0;
+	record.Time = run.Time;
+	record.Timestep = run.Timestep;
+	record.GGFScore = run.GGFScore;
+	record.UndiscountedCV = run.UndiscountedCV;
+	record.DiscountedCV = run.DiscountedCV;
+	for (int i = 0; i < 2; i++)
+	{
+		record.Undiscounted[i] = run.Undiscounted[i];
+		record.Discounted[i] = run.Discounted[i];
+	}
+
+	ofstream ofs(RunsFile.c_str(), ios::binary | ios::app);
+	ofs.write((const char*) &record, sizeof(record));
+	for (int t = 0; t < record.NumRewards; t++)
+		ofs.write((const char*) run.Rewards[t].data(), 2 * sizeof(double));
+	ofs.flush();
+}
+
+void CHECKPOINT::SaveEpisode(const EPISODE& episode, const STATE& real, const MCTS& mcts) const
+{
+	const HISTORY& history = mcts.GetHistory();
+	const BELIEF_STATE& beliefs = mcts.BeliefState();
+	int packedSize = Simulator.GetPackedSize();
+	if (packedSize == 0)
+		return;
+
+	EPISODE_HEADER header;
+	memcpy(header.Magic, EpisodeMagic, sizeof(header.Magic));
+	header.Doubles = episode.Doubles;
+	header.Run = episode.Run;
+	header.Steps = episode.Steps;
+	header.CollectedRocks = episode.CollectedRocks;
+	header.HistorySize = history.Size();
+	header.NumParticles = beliefs.GetAnalytic() ? 0 : beliefs.GetNumSamples();
+	header.PackedSize = packedSize;
+	header.Analytic = beliefs.GetAnalytic() != 0;
+	header.Elapsed = episode.Elapsed;
+	header.Discount = episode.Discount;
+	for (int i = 0; i < 2; i++)
+	{
+		header.Undiscounted[i] = episode.Undiscounted[i];
+		header.Discounted[i] = episode.Discounted[i];
+		header.Cumulative[i] = episode.Cumulative[i];
+	}
+	assert((int) episode.Rewards.size() == header.HistorySize);
+
+	// Written aside and renamed, so a crash leaves the previous episode intact
+	string tempFile = EpisodeFile + ".tmp";
+	ofstream ofs(tempFile.c_str(), ios::binary);
+	ofs.write((const char*) &header, sizeof(header));
+	for (int t = 0; t < history.Size(); t++)
+	{
+		std::int32_t entry[2] = { history[t].Action, history[t].Observation };
+		ofs.write((const char*) entry, sizeof(entry));
+	}
+	for (int t = 0; t < history.Size(); t++)
+		ofs.write((const char*) episode.Rewards[t].data(), 2 * sizeof(double));
+
+	vector<char> packed(packedSize);
+	Real.PackState(real, packed.data());
+	ofs.write(packed.data(), packedSize);
+	Pad(ofs);
+	for (int i = 0; i < header.NumParticles; i++)
+	{
+		std::int32_t count = beliefs.GetCount(i);
+		ofs.write((const char*) &count, sizeof(count));
+	}
+	Pad(ofs);
+	for (int i = 0; i < header.NumParticles; i++)
+	{
+		Simulator.PackState(*beliefs.GetSample(i), packed.data());
+		ofs.write(packed.data(), packedSize);
+	}
+	Pad(ofs);
+	OPENING_BOOK::Write(ofs, mcts.Root, mcts.Params.MaxDepth + 1, mcts.Params.OpenLoop);
+	ofs.close();
+	if (ofs.good())
+		rename(tempFile.c_str(), EpisodeFile.c_str());
+}
+
+bool CHECKPOINT::LoadEpisode(int doubles, int run, EPISODE& episode,
+	STATE*& real, MCTS& mcts) const
+{
+	MAPPED_FILE file;
+	if (!file.Open(EpisodeFile) || file.GetSize() < sizeof(EPISODE_HEADER))
+		return false;
+	const char* data = file.GetData();
+	EPISODE_HEADER header;
+	memcpy(&header, data, sizeof(header));
+	if (memcmp(header.Magic, EpisodeMagic, sizeof(EpisodeMagic)) != 0
+		|| header.Doubles != doubles || header.Run != run
+		|| header.PackedSize != Simulator.GetPackedSize())
+		return false;
+
+	episode.Doubles = header.Doubles;
+	episode.Run = header.Run;
+	episode.Steps = header.Steps;
+	episode.CollectedRocks = header.CollectedRocks;
+	episode.Elapsed = header.Elapsed;
+	episode.Discount = header.Discount;
+	episode.Undiscounted.assign(header.Undiscounted, header.Undiscounted + 2);
+	episode.Discounted.assign(header.Discounted, header.Discounted + 2);
+	episode.Cumulative.assign(header.Cumulative, header.Cumulative + 2);
+
+	// A file cut short or damaged by a crash starts the episode afresh, so
+	// every section is checked against the file before anything is unpacked
+	size_t size = file.GetSize();
+	if (header.HistorySize < 0 || header.NumParticles < 0
+		|| (size_t) header.HistorySize > size || (size_t) header.NumParticles > size)
+		return false;
+	size_t historyOffset = sizeof(header);
+	size_t rewardOffset = historyOffset + header.HistorySize * 2 * sizeof(std::int32_t);
+	size_t realOffset = rewardOffset + header.HistorySize * 2 * sizeof(double);
+	size_t countOffset = Padded(realOffset + header.PackedSize);
+	size_t particleOffset = Padded(countOffset + header.NumParticles * sizeof(std::int32_t));
+	size_t treeOffset = Padded(particleOffset + (size_t) header.NumParticles * header.PackedSize);
+	if (treeOffset > size)
+		return false;
+
+	const std::int32_t* entries = (const std::int32_t*) (data + historyOffset);
+	HISTORY history;
+	for (int t = 0; t < header.HistorySize; t++)
+	{
+		if (entries[2 * t] < 0 || entries[2 * t] >= Simulator.GetNumActions()
+			|| entries[2 * t + 1] < 0 || entries[2 * t + 1] >= Simulator.GetNumObservations())
+			return false;
+		history.Add(entries[2 * t], entries[2 * t + 1]);
+	}
+	const std::int32_t* counts = (const std::int32_t*) (data + countOffset);
+	bool compact = false;
+	for (int i = 0; i < header.NumParticles; i++)
+	{
+		if (counts[i] < 1)
+			return false;
+		compact = compact || counts[i] != 1;
+	}
+	ANALYTIC_BELIEF* analytic = header.Analytic ? Simulator.CreateAnalyticBelief() : 0;
+	if (header.Analytic && !analytic)
+		return false;
+	OPENING_BOOK* tree = OPENING_BOOK::Attach(data + treeOffset, size - treeOffset,
+		Simulator.GetNumActions(), Simulator.GetNumObservations(), mcts.Params.OpenLoop);
+	if (!tree)
+	{
+		delete analytic;
+		return false;
+	}
+
+	episode.Doubles = header.Doubles;
+	episode.Run = header.Run;
+	episode.Steps = header.Steps;
+	episode.CollectedRocks = header.CollectedRocks;
+	episode.Elapsed = header.Elapsed;
+	episode.Discount = header.Discount;
+	episode.Undiscounted.assign(header.Undiscounted, header.Undiscounted + 2);
+	episode.Discounted.assign(header.Discounted, header.Discounted + 2);
+	episode.Cumulative.assign(header.Cumulative, header.Cumulative + 2);
+	const double* rewards = (const double*) (data + rewardOffset);
+	episode.Rewards.resize(header.HistorySize);
+	for (int t = 0; t < header.HistorySize; t++)
+		episode.Rewards[t].assign(rewards + 2 * t, rewards + 2 * t + 2);
+
+	real = Real.UnpackState(data + realOffset);
+
+	// Closed-form beliefs are rebuilt by replaying the real history
+	BELIEF_STATE beliefs;
+	if (analytic)
+	{
+		for (int t = 0; t < history.Size(); t++)
+			analytic->Update(history[t].Action, history[t].Observation, episode.Rewards[t]);
+		beliefs.SetAnalytic(analytic);
+	}
+	for (int i = 0; i < header.NumParticles; i++)
+	{
+		STATE* state = Simulator.UnpackState(data + particleOffset + (size_t) i * header.PackedSize);
+		if (compact)
+			beliefs.AddSample(state, counts[i]);
+		else
+			beliefs.AddSample(state);
+	}
+
+	mcts.Restore(history, beliefs, tree->Build(0));
+	delete tree;
+	return true;
+}
+
+void CHECKPOINT::ClearEpisode() const
+{
+	remove(EpisodeFile.c_str());
+}
+
+//-----------------------------------------------------------------------------
+
+void CHECKPOINT::UnitTest()
+{
+	TEST_SIMULATOR testSimulator(3, 2, 2, 4);
+	MCTS::PARAMS params;
+	params.MaxDepth = 5;
+	params.NumSimulations = 200;
+	params.NumStartStates = 50;
+	MCTS mcts(testSimulator, params);
+	STATE* real = testSimulator.CreateStartState();
+	vector<double> cumulative(2, 0.0), reward;
+	int action = mcts.SelectAction(cumulative);
+	int observation;
+	testSimulator.Step(*real, action, observation, reward);
+	bool updated = mcts.Update(action, observation, reward);
+	assert(updated);
+	mcts.SelectAction(reward);
+
+	EPISODE episode;
+	episode.Doubles = 1;
+	episode.Run = 2;
+	episode.Steps = 1;
+	episode.CollectedRocks = 0;
+	episode.Elapsed = 0.5;
+	episode.Discount = 0.95;
+	episode.Undiscounted = episode.Discounted = episode.Cumulative = reward;
+	episode.Rewards.assign(1, reward);
+	CHECKPOINT checkpoint("pomcp_unittest", testSimulator, testSimulator);
+	checkpoint.SaveEpisode(episode, *real, mcts);
+
+	// The episode resumes with the same state, history, particles and tree
+	MCTS restored(testSimulator, params);
+	EPISODE loaded;
+	STATE* loadedReal = 0;
+	assert(!checkpoint.LoadEpisode(1, 3, loaded, loadedReal, restored));
+	assert(checkpoint.LoadEpisode(1, 2, loaded, loadedReal, restored));
+	assert(loaded.Steps == 1 && loaded.Elapsed == 0.5 && loaded.Rewards == episode.Rewards);
+	assert(safe_cast<TEST_STATE&>(*loadedReal).Depth == safe_cast<TEST_STATE&>(*real).Depth);
+	assert(restored.GetHistory() == mcts.GetHistory());
+	assert(restored.BeliefState().GetNumParticles() == mcts.BeliefState().GetNumParticles());
+	for (int a = 0; a < testSimulator.GetNumActions(); a++)
+		assert(restored.Root->Child(a).Value.GetCount() == mcts.Root->Child(a).Value.GetCount());
+	testSimulator.FreeState(loadedReal);
+
+	// A file cut short or with counts past its end falls back to a fresh episode
+	MAPPED_FILE file;
+	file.Open(checkpoint.EpisodeFile);
+	string data(file.GetData(), file.GetSize());
+	file.Close();
+	string truncated = data.substr(0, sizeof(EPISODE_HEADER) + 4);
+	string oversized = data;
+	((EPISODE_HEADER*) &oversized[0])->NumParticles = 1 << 20;
+	string corrupt[2] = { truncated, oversized };
+	for (int i = 0; i < 2; i++)
+	{
+		ofstream ofs(checkpoint.EpisodeFile.c_str(), ios::binary);
+		ofs.write(corrupt[i].data(), corrupt[i].size());
+		ofs.close();
+		loadedReal = 0;
+		assert(!checkpoint.LoadEpisode(1, 2, loaded, loadedReal, restored));
+		assert(!loadedReal);
+	}
+
+	checkpoint.ClearEpisode();
+	testSimulator.FreeState(real);
+}
@@ -0,0 +1,79 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "history.h"
+#include <string>
+#include <vector>
+#include <cstdint>
+
+class SIMULATOR;
+class STATE;
+class MCTS;
+
+// Experiment progress and the episode in progress, so that long experiments
+// can resume after a crash. Finished runs are appended to <prefix>.runs, the
+// current episode is rewritten atomically to <prefix>.episode with the real
+// state, the root particles and the search tree. Both are read back by mmap
+class CHECKPOINT
+{
+public:
+
+	struct RUN
+	{
+		int Doubles, Run;
+		double Time, Timestep, GGFScore, UndiscountedCV, DiscountedCV;
+		std::vector<double> Undiscounted, Discounted;
+		std::vector<std::vector<double> > Rewards; // per real step
+	};
+
+	struct EPISODE
+	{
+		int Doubles, Run;
+		int Steps, CollectedRocks;
+		double Elapsed, Discount;
+		std::vector<double> Undiscounted, Discounted, Cumulative;
+		std::vector<std::vector<double> > Rewards;
+	};
+
+	CHECKPOINT(const std::string& prefix, const SIMULATOR& real,
+		const SIMULATOR& simulator);
+
+	// Finished runs for this number of doublings, in the order they were added
+	void LoadRuns(int doubles, std::vector<RUN>& runs) const;
+	void AddRun(const RUN& run);
+
+	// The real state and search of an unfinished episode
+	void SaveEpisode(const EPISODE& episode, const STATE& real, const MCTS& mcts) const;
+	bool LoadEpisode(int doubles, int run, EPISODE& episode,
+		STATE*& real, MCTS& mcts) const;
+	void ClearEpisode() const;
+
+	static void UnitTest();
+
+private:
+
+	struct RUN_RECORD
+	{
+		std::int32_t Doubles;
+		std::int32_t Run;
+		std::int32_t NumRewards;
+		std::int32_t Pad;
+		double Time, Timestep, GGFScore, UndiscountedCV, DiscountedCV;
+		double Undiscounted[2], Discounted[2];
+	};
+
+	struct EPISODE_HEADER
+	{
+		char Magic[8];
+		std::int32_t Doubles, Run, Steps, CollectedRocks;
+		std::int32_t HistorySize, NumParticles, PackedSize, Analytic;
+		double Elapsed, Discount;
+		double Undiscounted[2], Discounted[2], Cumulative[2];
+	};
+
+	std::string RunsFile, EpisodeFile;
+	const SIMULATOR& Real;
+	const SIMULATOR& Simulator;
+};
+
+#endif // CHECKPOINT_H
@@ -0,0 +1,90 @@
+#ifndef DECISION_CACHE_H
+#define DECISION_CACHE_H
+
+#include "history.h"
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+// Root action statistics of past searches, keyed by the real history and
+// cumulative reward, so that later episodes reaching the same history can
+// warm-start or skip their search
+class DECISION_CACHE
+{
+public:
+
+	struct ENTRY
+	{
+		HISTORY History;
+		std::vector<double> CumulativeReward;
+		std::vector<int> Counts;      // per action
+		std::vector<double> Totals;   // per action and objective
+		int TotalCount;
+	};
+
+	DECISION_CACHE(int numActions, int numObjectives, int numSimulations)
+		: NumActions(numActions),
+		NumObjectives(numObjectives),
+		NumSimulations(numSimulations)
+	{
+	}
+
+	// Statistics were gathered for this problem and search budget
+	bool Matches(int numActions, int numSimulations) const
+	{
+		return numActions == NumActions && numSimulations == NumSimulations;
+	}
+
+	const ENTRY* Find(const HISTORY& history, const std::vector<double>& cumulativeReward) const
+	{
+		auto i_entry = Entries.find(Key(history, cumulativeReward));
+		if (i_entry == Entries.end() || !(i_entry->second.History == history)
+			|| i_entry->second.CumulativeReward != cumulativeReward)
+			return 0;
+		return &i_entry->second;
+	}
+
+	// Adds the visits and returns of one search, replacing any colliding entry
+	ENTRY& Add(const HISTORY& history, const std::vector<double>& cumulativeReward)
+	{
+		ENTRY& entry = Entries[Key(history, cumulativeReward)];
+		if (!(entry.History == history) || entry.CumulativeReward != cumulativeReward
+			|| entry.Counts.empty())
+		{
+			entry.History = history;
+			entry.CumulativeReward = cumulativeReward;
+			entry.Counts.assign(NumActions, 0);
+			entry.Totals.assign(NumActions * NumObjectives, 0.0);
+			entry.TotalCount = 0;
+		}
+		return entry;
+	}
+
+	int GetNumEntries() const { return Entries.size(); }
+
+private:
+
+	static std::uint64_t Key(const HISTORY& history, const std::vector<double>& cumulativeReward)
+	{
+		// FNV-1a over the action-observation pairs and the reward so far
+		std::uint64_t key = 0xcbf29ce484222325ull;
+		auto mix = [&key](std::uint64_t value)
+		{
+			key ^= value;
+			key *= 0x100000001b3ull;
+		};
+		for (int t = 0; t < history.Size(); ++t)
+		{
+			mix(history[t].Action);
+			mix(history[t].Observation);
+		}
+		for (double reward : cumulativeReward)
+			mix(std::hash<double>()(reward));
+		return key;
+	}
+
+	int NumActions, NumObjectives, NumSimulations;
+	std::unordered_map<std::uint64_t, ENTRY> Entries;
+};
+
+#endif // DECISION_CACHE_H
@@ -1,5 +1,6 @@
 #include "experiment.h"
 #include "boost/timer.hpp"
+#include <chrono>
 
 using namespace std;
 using namespace UTILS;
@@ -28,7 +29,8 @@ EXPERIMENT::PARAMS::PARAMS()
 	Accuracy(0.01),
 	UndiscountedHorizon(1000),
 	AutoExploration(true),
-	usePOSTS(false)
+	usePOSTS(false),
+	CheckpointInterval(60)
 {
 }
 
@@ -39,7 +41,8 @@ EXPERIMENT::EXPERIMENT(const SIMULATOR& real,
 	Simulator(simulator),
 	OutputFile(outputFile.c_str()),
 	ExpParams(expParams),
-	SearchParams(searchParams)
+	SearchParams(searchParams),
+	BookSaved(false)
 {
 	if (ExpParams.AutoExploration)
 	{
@@ -49,9 +52,11 @@ EXPERIMENT::EXPERIMENT(const SIMULATOR& real,
 			SearchParams.ExplorationConstant = simulator.GetRewardRange();
 	}
 	MCTS::InitFastUCB(SearchParams.ExplorationConstant);
+	if (!ExpParams.Checkpoint.empty())
+		Checkpoint.reset(new CHECKPOINT(ExpParams.Checkpoint, Real, Simulator));
 }
 
-void EXPERIMENT::Run()
+void EXPERIMENT::Run(int run)
 {
 	boost::timer timer;
 
@@ -75,26 +80,57 @@ void EXPERIMENT::Run()
 	bool outOfParticles = false;
 	int t = 0;
 	int collectRockNum = 0;
+	double elapsed = 0;
+	std::vector<std::vector<double> > stepRewards;
 
-	STATE* state = Real.CreateStartState();
+	PROFILE::Take();
+	PROFILE::TOTALS episodeProfile;
+
+	STATE* state = 0;
+	CHECKPOINT::EPISODE episode;
+	if (Checkpoint && Checkpoint->LoadEpisode(Doubles, run, episode, state, *mcts))
+	{
+		t = episode.Steps;
+		collectRockNum = episode.CollectedRocks;
+		elapsed = episode.Elapsed;
+		discount = episode.Discount;
+		undiscountedReturn = episode.Undiscounted;
+		discountedReturn = episode.Discounted;
+		cumulativeReward = episode.Cumulative;
+		stepRewards = episode.Rewards;
+		for (int i = 0; i < (int) stepRewards.size(); i++)
+			Results.Reward.Add(stepRewards[i]);
+		cout << "Resuming run from checkpoint after " << t << " steps" << endl;
+	}
+	else
+		state = Real.CreateStartState();
+	auto lastCheckpoint = std::chrono::steady_clock::now();
 	if (SearchParams.Verbose >= 1)
 		Real.DisplayState(*state, cout);
 
 	// for (t = 0; t < ExpParams.NumSteps; t++)
-	for (collectRockNum = 0; collectRockNum < 4; )
+	for (; collectRockNum < 4; )
 	{
 		int observation;
 		vector<double> reward;
 		// SearchParams.MaxDepth = ExpParams.NumSteps - t;
         int action = mcts->SelectAction(cumulativeReward);
+		if (!SearchParams.SaveBook.empty() && !BookSaved && mcts->GetHistory().Size() == 0)
+		{
+			BookSaved = true;
+			if (!mcts->SaveBook())
+				cout << "Cannot write book " << SearchParams.SaveBook << endl;
+		}
         // cout << "action: " << action << endl;
-		terminal = Real.Step(*state, action, observation, reward);
-		t++;
+		int steps;
+		terminal = Real.MacroStep(*state, action, observation, reward, steps);
+		t += steps;
 		if (accumulate(reward.begin(), reward.end(), 0) > 0) {
 			collectRockNum++;
 			// cout << "collect " << collectRockNum << " rocks." << endl;
 		}
 		Results.Reward.Add(reward);
+		stepRewards.push_back(reward);
 		for (int i =0; i < 2; i++){
 			undiscountedReturn[i] += reward[i];
 			discountedReturn[i] += reward[i] * discount;
@@ -107,7 +143,7 @@ void EXPERIMENT::Run()
         // cout << "----------------------------------------" << endl;
 		// undiscountedReturn += reward;
 		// discountedReturn += reward * discount;
-		discount *= Real.GetDiscount();
+		discount *= pow(Real.GetDiscount(), steps);
 		if (SearchParams.Verbose >= 1)
 		{
 			Real.DisplayAction(action, cout);
@@ -122,11 +158,35 @@ void EXPERIMENT::Run()
 			break;
 		}
 		outOfParticles = !mcts->Update(action, observation, reward);
+		if (PROFILE::Enabled)
+		{
+			PROFILE::TOTALS decision = PROFILE::Take();
+			if (SearchParams.Verbose >= 1)
+				decision.Print("Decision profile", cout);
+			episodeProfile.Add(decision);
+		}
         if (outOfParticles) cout << "No particles!" << endl;
 		if (outOfParticles)
 			break;
 
-		if (timer.elapsed() > ExpParams.TimeOut)
+		if (Checkpoint && std::chrono::duration<double>(std::chrono::steady_clock::now()
+			- lastCheckpoint).count() >= ExpParams.CheckpointInterval)
+		{
+			episode.Doubles = Doubles;
+			episode.Run = run;
+			episode.Steps = t;
+			episode.CollectedRocks = collectRockNum;
+			episode.Elapsed = elapsed + timer.elapsed();
+			episode.Discount = discount;
+			episode.Undiscounted = undiscountedReturn;
+			episode.Discounted = discountedReturn;
+			episode.Cumulative = cumulativeReward;
+			episode.Rewards = stepRewards;
+			Checkpoint->SaveEpisode(episode, *state, *mcts);
+			lastCheckpoint = std::chrono::steady_clock::now();
+		}
+
+		if (elapsed + timer.elapsed() > ExpParams.TimeOut)
 		{
 			cout << "Timed out after " << collectRockNum << " rocks collected in "
 				<< Results.Time.GetTotal() << "seconds" << endl;
@@ -147,16 +207,19 @@ void EXPERIMENT::Run()
 			// SelectRandom must only use fully observable state
 			// to avoid "cheating"
 			int action = Simulator.SelectRandom(*state, history, mcts->GetStatus());
-			terminal = Real.Step(*state, action, observation, reward);
+			int steps;
+			terminal = Real.MacroStep(*state, action, observation, reward, steps);
+			t += steps - 1;
 
 			Results.Reward.Add(reward);
+			stepRewards.push_back(reward);
 			for (int i =0; i < 2; i++){
 				undiscountedReturn[i] += reward[i];
 				discountedReturn[i] += reward[i] * discount;
 			}
 			// undiscountedReturn += reward;
 			// discountedReturn += reward * discount;
-			discount *= Real.GetDiscount();
+			discount *= pow(Real.GetDiscount(), steps);
 			if (SearchParams.Verbose >= 1)
 			{
 				Real.DisplayAction(action, cout);
@@ -175,7 +238,8 @@ void EXPERIMENT::Run()
 		}
 	}
 
-	Results.Time.Add(timer.elapsed());
+	double time = elapsed + timer.elapsed();
+	Results.Time.Add(time);
 	Results.Timestep.Add(t);
 	Results.GGFScore.Add(GGF(undiscountedReturn));
 	Results.UndiscountedRewCV.Add(CV(undiscountedReturn));
@@ -189,17 +253,66 @@ void EXPERIMENT::Run()
 		<< ", average = " << Results.DiscountedReturn.GetMean() << endl;
 	cout << "Undiscounted return = " << undiscountedReturn
 		<< ", average = " << Results.UndiscountedReturn.GetMean() << endl;
+
+	if (Checkpoint)
+	{
+		CHECKPOINT::RUN record;
+		record.Doubles = Doubles;
+		record.Run = run;
+		record.Time = time;
+		record.Timestep = t;
+		record.GGFScore = GGF(undiscountedReturn);
+		record.UndiscountedCV = CV(undiscountedReturn);
+		record.DiscountedCV = CV(discountedReturn);
+		record.Undiscounted = undiscountedReturn;
+		record.Discounted = discountedReturn;
+		record.Rewards = stepRewards;
+		Checkpoint->AddRun(record);
+		Checkpoint->ClearEpisode();
+	}
+	Real.FreeState(state);
 	delete mcts;
+
+	if (PROFILE::Enabled)
+	{
+		episodeProfile.Add(PROFILE::Take());
+		episodeProfile.Print("Episode profile", cout);
+		Results.Profile.Add(episodeProfile);
+	}
+}
+
+int EXPERIMENT::RestoreRuns()
+{
+	if (!Checkpoint)
+		return 0;
+	std::vector<CHECKPOINT::RUN> runs;
+	Checkpoint->LoadRuns(Doubles, runs);
+	for (int n = 0; n < (int) runs.size(); n++)
+	{
+		const CHECKPOINT::RUN& run = runs[n];
+		for (int t = 0; t < (int) run.Rewards.size(); t++)
+			Results.Reward.Add(run.Rewards[t]);
+		Results.Time.Add(run.Time);
+		Results.Timestep.Add(run.Timestep);
+		Results.GGFScore.Add(run.GGFScore);
+		Results.UndiscountedRewCV.Add(run.UndiscountedCV);
+		Results.DiscountedRewCV.Add(run.DiscountedCV);
+		Results.UndiscountedReturn.Add(run.Undiscounted);
+		Results.DiscountedReturn.Add(run.Discounted);
+	}
+	if (!runs.empty())
+		cout << "Restored " << runs.size() << " runs from checkpoint" << endl;
+	return runs.size();
 }
 
-void EXPERIMENT::MultiRun()
+void EXPERIMENT::MultiRun(int firstRun)
 {
 	int numberOfRuns = ExpParams.NumRuns;
-	for (int n = 0; n < numberOfRuns; n++)
+	for (int n = firstRun; n < numberOfRuns; n++)
 	{
 		cout << "Starting run " << n + 1 << " with "
 			<< SearchParams.NumSimulations << " simulations... " << endl;
-		Run();
+		Run(n);
 		if (Results.Time.GetTotal() > ExpParams.TimeOut)
 		{
 			cout << "Timed out after " << n << " runs in "
@@ -231,7 +344,8 @@ void EXPERIMENT::DiscountedReturn()
 		SearchParams.MaxAttempts = SearchParams.NumTransforms * ExpParams.TransformAttempts;
 
 		Results.Clear();
-		MultiRun();
+		Doubles = i;
+		MultiRun(RestoreRuns());
 
 		cout << "Simulations = " << SearchParams.NumSimulations << endl
 			<< "Runs = " << Results.Time.GetCount() << endl
@@ -248,6 +362,8 @@ void EXPERIMENT::DiscountedReturn()
 			<< " +- " << Results.Timestep.GetStdErr() << endl
 			<< "GGF score = " << Results.GGFScore.GetMean()
 			<< " +- " << Results.GGFScore.GetStdErr() << endl;
+		if (PROFILE::Enabled)
+			Results.Profile.Print("Search profile", cout);
 		OutputFile << SearchParams.NumSimulations << "\t"
 			<< Results.Time.GetCount() << "\t"
 			<< Results.UndiscountedReturn.GetMean() << "\t"
@@ -284,13 +400,17 @@ void EXPERIMENT::AverageReward()
 		SearchParams.MaxAttempts = SearchParams.NumTransforms * ExpParams.TransformAttempts;
 
 		Results.Clear();
-		Run();
+		Doubles = i;
+		if (RestoreRuns() == 0)
+			Run();
 
 		cout << "Simulations = " << SearchParams.NumSimulations << endl
 			<< "Steps = " << Results.Reward.GetCount() << endl
 			<< "Average reward = " << Results.Reward.GetMean()
 			<< " +- " << Results.Reward.GetStdErr() << endl
 			<< "Average time = " << Results.Time.GetMean() / Results.Reward.GetCount() << endl;
+		if (PROFILE::Enabled)
+			Results.Profile.Print("Search profile", cout);
 		OutputFile << SearchParams.NumSimulations << "\t"
 			<< Results.Reward.GetCount() << "\t"
 			<< Results.Reward.GetMean() << "\t"
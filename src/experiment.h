@@ -6,8 +6,11 @@
 #include "statistic.h"
 #include "vectorstatistic.h"
 #include "rocksample.h"
+#include "checkpoint.h"
+#include "profile.h"
 #include <fstream>
 #include <numeric>
+#include <memory>
 // #include "planner.h"
 
 //----------------------------------------------------------------------------
@@ -25,6 +28,7 @@ struct RESULTS
 	VECTORSTATISTIC DiscountedReturn = VECTORSTATISTIC(2);
 	VECTORSTATISTIC UndiscountedReturn = VECTORSTATISTIC(2);
     STATISTIC MaxNumberOfBandits;
+	PROFILE::TOTALS Profile;
 };
 
 inline void RESULTS::Clear()
@@ -37,6 +41,7 @@ inline void RESULTS::Clear()
 	Reward.Clear();
 	DiscountedReturn.Clear();
 	UndiscountedReturn.Clear();
+	Profile.Clear();
 }
 
 //----------------------------------------------------------------------------
@@ -62,14 +67,16 @@ public:
 		bool usePOSTS;
 		bool ggi;
 		bool ws; // weighted sum
+		std::string Checkpoint; // file prefix for resumable progress, empty for none
+		double CheckpointInterval; // seconds between episode checkpoints
 	};
 
 	EXPERIMENT(const SIMULATOR& real, const SIMULATOR& simulator,
 		const std::string& outputFile,
 		EXPERIMENT::PARAMS& expParams, MCTS::PARAMS& searchParams);
 
-	void Run();
-	void MultiRun();
+	void Run(int run = 0);
+	void MultiRun(int firstRun = 0);
 	void DiscountedReturn();
 	void AverageReward();
 
@@ -81,6 +88,14 @@ private:
 	MCTS::PARAMS& SearchParams;
 	RESULTS Results;
 
+	// Resume support: finished runs are replayed into Results
+	std::unique_ptr<CHECKPOINT> Checkpoint;
+	int Doubles;
+	int RestoreRuns();
+
+	// The opening book is written once, from the first search of the experiment
+	bool BookSaved;
+
 	std::ofstream OutputFile;
 };
 
@@ -1,3 +1,4 @@
+#include "bandit.h"
 // #include "battleship.h"
 #include "mcts.h"
 // #include "network.h"
@@ -5,20 +6,27 @@
 #include "rocksample.h"
 // #include "tag.h"
 #include "experiment.h"
+#include "checkpoint.h"
 #include <boost/program_options.hpp>
 
 using namespace std;
 using namespace boost::program_options;
 
-// void UnitTests()
-// {
-//     cout << "Testing UTILS" << endl;
-//     UTILS::UnitTest();
-//     cout << "Testing COORD" << endl;
-//     COORD::UnitTest();
-//     cout << "Testing MCTS" << endl;
-//     MCTS::UnitTest();
-// }
+void UnitTests()
+{
+    cout << "Testing BANDIT" << endl;
+    Bandit::UnitTest();
+    cout << "Testing UTILS" << endl;
+    UTILS::UnitTest();
+    cout << "Testing COORD" << endl;
+    COORD::UnitTest();
+    cout << "Testing CHECKPOINT" << endl;
+    CHECKPOINT::UnitTest();
+    cout << "Testing MCTS" << endl;
+    MCTS::UnitTest();
+    cout << "Testing ROCKSAMPLE" << endl;
+    ROCKSAMPLE::UnitTest();
+}
 
 void disableBufferedIO(void)
 {
@@ -37,6 +45,7 @@ int main(int argc, char* argv[])
     SIMULATOR::KNOWLEDGE knowledge;
     string problem, outputfile, policy;
     int size, number, treeknowledge = 1, rolloutknowledge = 1, smarttreecount = 10;
+    bool macroactions = false;
     double smarttreevalue = 1.0;
 
     options_description desc("Allowed options");
@@ -46,10 +55,15 @@ int main(int argc, char* argv[])
         ("problem", value<string>(&problem), "problem to run")
         ("outputfile", value<string>(&outputfile)->default_value("output.txt"), "summary output file")
 		("strategy", value<string>(&searchParams.Strategy)->default_value("GGF"), "action selection strategy")
+        ("rootallocator", value<string>(&searchParams.RootAllocator), "Root simulation allocation: ucb, halving or toptwo")
+        ("treepolicy", value<string>(&searchParams.TreePolicy), "Tree policy exploration: ucb1, ucbv or pareto")
         ("policy", value<string>(&policy), "policy file (explicit POMDPs only)")
         ("size", value<int>(&size), "size of problem (problem specific)")
+        ("macroactions", value<bool>(&macroactions), "Use go-to-rock and exit macro actions (rocksample)")
         ("number", value<int>(&number), "number of elements in problem (problem specific)")
         ("timeout", value<double>(&expParams.TimeOut), "timeout (seconds)")
+        ("checkpoint", value<string>(&expParams.Checkpoint), "File prefix to checkpoint to and resume from")
+        ("checkpointinterval", value<double>(&expParams.CheckpointInterval), "Seconds between checkpoints of the current episode")
         ("mindoubles", value<int>(&expParams.MinDoubles), "minimum power of two simulations")
         ("maxdoubles", value<int>(&expParams.MaxDoubles), "maximum power of two simulations")
         ("runs", value<int>(&expParams.NumRuns), "number of runs")
@@ -70,6 +84,28 @@ int main(int argc, char* argv[])
         ("smarttreecount", value<int>(&knowledge.SmartTreeCount), "Prior count for preferred actions during smart tree search")
         ("smarttreevalue", value<double>(&knowledge.SmartTreeValue), "Prior value for preferred actions during smart tree search")
         ("disabletree", value<bool>(&searchParams.DisableTree), "Use 1-ply rollout action selection")
+        ("leafdepth", value<int>(&searchParams.LeafDepth), "Rollout steps before using the simulator leaf value (-1 to disable)")
+        ("rolloutcache", value<int>(&searchParams.RolloutCacheSize), "Slots in the rollout return cache (0 to disable)")
+        ("rolloutcachecount", value<int>(&searchParams.RolloutCacheCount), "Rollouts recorded before using the cached mean return")
+        ("mast", value<bool>(&searchParams.Mast), "Sample rollout actions from persistent per-action returns (MAST)")
+        ("masttemperature", value<double>(&searchParams.MastTemperature), "Gibbs temperature for MAST rollouts")
+        ("openloop", value<bool>(&searchParams.OpenLoop), "Open-loop search: tree nodes keyed by action sequence only")
+        ("adaptivebudget", value<bool>(&searchParams.AdaptiveBudget), "Vary simulations per step with belief entropy and root concentration, within the per-episode budget")
+        ("undo", value<bool>(&searchParams.UndoSimulation), "Simulate on the particles themselves and undo the steps, if the simulator supports it")
+        ("decisioncache", value<bool>(&searchParams.DecisionCache), "Warm-start root searches from earlier episodes with the same history")
+        ("decisioncacheskip", value<double>(&searchParams.DecisionCacheSkip), "Cached root visits, in searches, after which a search is skipped")
+        ("book", value<string>(&searchParams.BookFile), "Opening book of searched tree statistics, merged into early roots")
+        ("savebook", value<string>(&searchParams.SaveBook), "Write the first searched tree of the experiment to this opening book")
+        ("bookdepth", value<int>(&searchParams.BookDepth), "Tree levels written to the opening book")
+        ("budgetconcentration", value<double>(&searchParams.BudgetConcentration), "Root visit share of one action that ends an adaptive search early")
+        ("successivehalving", value<bool>(&searchParams.SuccessiveHalving), "Successive halving of root actions in 1-ply rollout search")
+        ("ponder", value<bool>(&searchParams.Ponder), "Keep searching below the chosen action while the real environment steps")
+        ("threads", value<int>(&searchParams.NumThreads), "Number of worker threads")
+        ("weightedbelief", value<bool>(&searchParams.WeightedBelief), "Reweight and resample particles by observation likelihood")
+        ("compactbelief", value<bool>(&searchParams.CompactBelief), "Store duplicate root particles once with a count")
+        ("analyticbelief", value<bool>(&searchParams.AnalyticBelief), "Track the belief in closed form instead of particles (rocksample)")
+        ("ensemble", value<string>(&searchParams.EnsembleMode), "Ensemble planning: none, vote or pooled")
+        ("ensemblesize", value<int>(&searchParams.EnsembleSize), "Number of independent searches in ensemble planning")
         ;
 
     variables_map vm;
@@ -82,19 +118,19 @@ int main(int argc, char* argv[])
         return 1;
     }
 
+    if (vm.count("test"))
+    {
+        cout << "Running unit tests" << endl;
+        UnitTests();
+        return 0;
+    }
+
     if (vm.count("problem") == 0)
     {
         cout << "No problem specified" << endl;
         return 1;
     }
 
-    // if (vm.count("test"))
-    // {
-    //     cout << "Running unit tests" << endl;
-    //     UnitTests();
-    //     return 0;
-    // }
-
     SIMULATOR* real = 0;
     SIMULATOR* simulator = 0;
 
@@ -125,8 +161,8 @@ int main(int argc, char* argv[])
     // }
     if (problem == "rocksample")
     {
-        real = new ROCKSAMPLE(size, number, 2);
-        simulator = new ROCKSAMPLE(size, number, 2);
+        real = new ROCKSAMPLE(size, number, 2, macroactions);
+        simulator = new ROCKSAMPLE(size, number, 2, macroactions);
     }
     else 
     {
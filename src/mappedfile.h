@@ -0,0 +1,63 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Whole file mapped read-only into memory, unmapped on destruction
+class MAPPED_FILE
+{
+public:
+
+	MAPPED_FILE()
+		: Data(0), Size(0)
+	{
+	}
+
+	~MAPPED_FILE()
+	{
+		Close();
+	}
+
+	bool Open(const std::string& filename)
+	{
+		Close();
+		int fd = open(filename.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		void* data = MAP_FAILED;
+		if (fstat(fd, &st) == 0 && st.st_size > 0)
+			data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (data == MAP_FAILED)
+			return false;
+		Data = (const char*) data;
+		Size = st.st_size;
+		return true;
+	}
+
+	void Close()
+	{
+		if (Data)
+			munmap((void*) Data, Size);
+		Data = 0;
+		Size = 0;
+	}
+
+	const char* GetData() const { return Data; }
+	std::size_t GetSize() const { return Size; }
+
+private:
+
+	MAPPED_FILE(const MAPPED_FILE&);
+	MAPPED_FILE& operator=(const MAPPED_FILE&);
+
+	const char* Data;
+	std::size_t Size;
+};
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,54 @@
+#ifndef MAST_H
+#define MAST_H
+
+#include "utils.h"
+#include <vector>
+#include <atomic>
+
+// Move-Average Sampling Technique: per-action mean vector returns, updated
+// from backed-up simulation returns and shared by concurrent searches
+class MAST
+{
+public:
+
+	MAST(int numActions, int numObjectives)
+		: NumActions(numActions),
+		NumObjectives(numObjectives),
+		Counts(numActions),
+		Totals(numActions * numObjectives)
+	{
+		for (int a = 0; a < NumActions; ++a)
+			Counts[a].store(0, std::memory_order_relaxed);
+		for (int i = 0; i < NumActions * NumObjectives; ++i)
+			Totals[i].store(0.0, std::memory_order_relaxed);
+	}
+
+	int GetNumActions() const { return NumActions; }
+
+	void Add(int action, const std::vector<double>& value)
+	{
+		for (int i = 0; i < NumObjectives; i++)
+			UTILS::AtomicAdd(Totals[action * NumObjectives + i], value[i]);
+		Counts[action].fetch_add(1, std::memory_order_release);
+	}
+
+	// Mean return of action, false if it has never been backed up
+	bool GetValue(int action, std::vector<double>& value) const
+	{
+		int count = Counts[action].load(std::memory_order_acquire);
+		if (count == 0)
+			return false;
+		value.resize(NumObjectives);
+		for (int i = 0; i < NumObjectives; i++)
+			value[i] = Totals[action * NumObjectives + i].load(std::memory_order_relaxed) / count;
+		return true;
+	}
+
+private:
+
+	int NumActions, NumObjectives;
+	std::vector<std::atomic<int> > Counts;
+	std::vector<std::atomic<double> > Totals;
+};
+
+#endif // MAST_H
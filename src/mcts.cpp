@@ -1,8 +1,13 @@
 #include "mcts.h"
 #include "testsimulator.h"
+#include "bandit.h"
+#include "profile.h"
 #include <math.h>
 
 #include <algorithm>
+#include <unordered_map>
+#include <chrono>
+#include <sstream>
 
 using namespace std;
 using namespace UTILS;
@@ -33,50 +38,141 @@ MCTS::PARAMS::PARAMS()
 	EnsembleSize(4),
     BanditArmCapacity(10),
     BanditConvergenceEpsilon(0.01),
+	BanditBetaPrior(1),
 	ExplorationConstant(1),
 	UseRave(false),
 	RaveDiscount(1.0),
 	RaveConstant(0.01),
 	DisableTree(false),
 	Strategy("GGF"),
-	ConsiderPast(true)
+	TreePolicy("ucb1"),
+	RootAllocator("ucb"),
+	ConsiderPast(true),
+	Ponder(false),
+	NumThreads(1),
+	WeightedBelief(false),
+	CompactBelief(false),
+	AnalyticBelief(false),
+	EnsembleMode("none"),
+	SuccessiveHalving(false),
+	LeafDepth(-1),
+	RolloutCacheSize(0),
+	RolloutCacheCount(16),
+	Mast(false),
+	MastTemperature(1.0),
+	OpenLoop(false),
+	AdaptiveBudget(false),
+	BudgetConcentration(0.9),
+	UndoSimulation(false),
+	DecisionCache(false),
+	DecisionCacheSkip(4),
+	BookDepth(4)
 {
 }
 
 MCTS::MCTS(const SIMULATOR& simulator, const PARAMS& params)
 	: Simulator(simulator),
 	Params(params),
-	TreeDepth(0)
+	TreeDepth(0),
+	PathLength(0),
+	PonderStop(false),
+	PonderSimulations(0),
+	Undoing(false),
+	RootChoice(-1),
+	BudgetBank(0),
+	LastConcentration(0)
 {
 	VNODE::NumChildren = Simulator.GetNumActions();
-	QNODE::NumChildren = Simulator.GetNumObservations();
+	// Open-loop nodes share one child for all observations
+	QNODE::NumChildren = Params.OpenLoop ? 1 : Simulator.GetNumObservations();
+
+
+	bool ggf = Params.Strategy == "GGF";
+	Scalarise = ggf ? &GGF : &WS;
+	if (Params.TreePolicy == "ucbv")
+		TreeSelect = ggf ? &MCTS::SelectScalarised<GGF_SCALARISATION, UCBV_BONUS>
+			: &MCTS::SelectScalarised<WS_SCALARISATION, UCBV_BONUS>;
+	else if (Params.TreePolicy == "pareto")
+		TreeSelect = ggf ? &MCTS::SelectPareto<GGF_SCALARISATION, UCB1_BONUS>
+			: &MCTS::SelectPareto<WS_SCALARISATION, UCB1_BONUS>;
+	else
+		TreeSelect = ggf ? &MCTS::SelectScalarised<GGF_SCALARISATION, UCB1_BONUS>
+			: &MCTS::SelectScalarised<WS_SCALARISATION, UCB1_BONUS>;
+
+	if (Params.RolloutCacheSize > 0)
+		RolloutCache.reset(new ROLLOUT_CACHE(Params.RolloutCacheSize, 2));
+	if (Params.Mast && (!Mast || Mast->GetNumActions() != Simulator.GetNumActions()))
+		Mast.reset(new MAST(Simulator.GetNumActions(), 2));
+	if (Params.DecisionCache && (!Decisions
+		|| !Decisions->Matches(Simulator.GetNumActions(), Params.NumSimulations)))
+		Decisions.reset(new DECISION_CACHE(Simulator.GetNumActions(), 2, Params.NumSimulations));
+	if (!Params.BookFile.empty() && (!Book || Book->GetFilename() != Params.BookFile))
+	{
+		Book.reset(OPENING_BOOK::Open(Params.BookFile, Simulator.GetNumActions(),
+			Simulator.GetNumObservations(), Params.OpenLoop));
+		if (Book)
+			cout << "Opened book " << Params.BookFile << " with "
+				<< Book->GetNumNodes() << " nodes" << endl;
+	}
 
-	Root = ExpandNode(Simulator.CreateStartState());
+	STATE* startState = Simulator.CreateStartState();
+	Root = ExpandNode(startState);
+	Simulator.FreeState(startState);
 
-	for (int i = 0; i < Params.NumStartStates; i++)
-		Root->Beliefs().AddSample(Simulator.CreateStartState());
+	ANALYTIC_BELIEF* analytic = Params.AnalyticBelief ? Simulator.CreateAnalyticBelief() : 0;
+	if (analytic)
+	{
+		Root->Beliefs().SetAnalytic(analytic);
+		return;
+	}
+
+	std::vector<STATE*> startStates;
+	CreateStartStates(startStates);
+	for (int i = 0; i < (int) startStates.size(); i++)
+		Root->Beliefs().AddSample(startStates[i]);
+	if (Params.CompactBelief)
+	{
+		Root->Beliefs().Compact(Simulator);
+		if (Params.Verbose >= 1)
+			cout << "Compacted " << Root->GetBeliefs().GetNumParticles() << " start states into "
+				<< Root->GetBeliefs().GetNumSamples() << " unique states" << endl;
+	}
 }
 
 MCTS::~MCTS()
 {
-	VNODE::Free(Root, Simulator);
-	VNODE::FreeAll();
+	StopPondering();
+	Ponderer.reset();
+	if (Root)
+		VNODE::Free(Root, Simulator);
+	// Other searches (ensemble members) may still share the node pool
+	if (VNODE::GetNumAllocated() == 0)
+		VNODE::FreeAll();
 }
 
 bool MCTS::Update(int action, int observation, vector<double>& reward)
 {
+	StopPondering();
+	PROFILE_SCOPE(UPDATE);
 	History.Add(action, observation);
 	BELIEF_STATE beliefs;
+	const ANALYTIC_BELIEF* analytic = Root->GetBeliefs().GetAnalytic();
+	bool reweighted = false;
 
 	// Find matching vnode from the rest of the tree
 	QNODE& qnode = Root->Child(action);
-	VNODE* vnode = qnode.Child(observation);
+	VNODE* vnode = qnode.Child(ChildIndex(observation));
 	if (vnode)
 	{
-		// cout << "Matched " << vnode->Beliefs().GetNumSamples() << " states" << endl;
+		// cout << "Matched " << vnode->GetBeliefs().GetNumSamples() << " states" << endl;
 		if (Params.Verbose >= 1)
-			cout << "Matched " << vnode->Beliefs().GetNumSamples() << " states" << endl;
-		beliefs.Copy(vnode->Beliefs(), Simulator);
+			cout << "Matched " << vnode->GetBeliefs().GetNumSamples() << " states" << endl;
+		// When pondering the matched node is adopted whole, particles included.
+		// Otherwise its particles are taken over, the node is freed below.
+		// Open-loop nodes hold no particles of their own
+		if (!Params.Ponder && !Params.WeightedBelief && !Params.OpenLoop && !analytic
+			&& !vnode->GetBeliefs().Empty())
+			beliefs.Move(vnode->Beliefs());
 	}
 	else
 	{
@@ -85,88 +181,574 @@ bool MCTS::Update(int action, int observation, vector<double>& reward)
 			cout << "No matching node found" << endl;
 	}
 
-	// Generate transformed states to avoid particle deprivation
-	if (Params.UseTransforms)
-		AddTransforms(Root, beliefs);
+	if (analytic)
+	{
+		// Exact belief update, no particles involved
+		ANALYTIC_BELIEF* posterior = analytic->Clone();
+		posterior->Update(action, observation, reward);
+		beliefs.SetAnalytic(posterior);
+	}
+	else
+	{
+		// Reweight and resample the previous particle set by the real observation,
+		// otherwise generate transformed states to avoid particle deprivation
+		reweighted = (Params.WeightedBelief || Params.OpenLoop)
+			&& ReweightBeliefs(action, observation, beliefs);
+		if (Params.UseTransforms && !reweighted)
+			AddTransforms(Root, beliefs);
+	}
 
 	// If we still have no particles, fail
-	if (beliefs.Empty() && (!vnode || vnode->Beliefs().Empty()))
+	if (beliefs.Empty() && (!vnode || vnode->GetBeliefs().Empty()))
 		return false;
 
 	if (Params.Verbose >= 1)
 		Simulator.DisplayBeliefs(beliefs, cout);
 
+	// Keep the (pondered) subtree below the real observation as the new root
+	if (Params.Ponder && vnode)
+	{
+		qnode.Child(ChildIndex(observation)) = 0;
+		VNODE::Free(Root, Simulator);
+		// Resampled particles already stand for the whole posterior
+		if (reweighted && !vnode->GetBeliefs().Empty())
+			vnode->Beliefs().Free(Simulator);
+		vnode->Beliefs().Move(beliefs);
+		Root = vnode;
+		if (Params.CompactBelief)
+			Root->Beliefs().Compact(Simulator);
+		return true;
+	}
+
 	// Find a state to initialise prior (only requires fully observed state)
 	const STATE* state = 0;
-	if (vnode && !vnode->Beliefs().Empty())
-		state = vnode->Beliefs().GetSample(0);
-	else
+	STATE* sample = 0;
+	if (vnode && vnode->GetBeliefs().GetNumSamples() > 0)
+		state = vnode->GetBeliefs().GetSample(0);
+	else if (beliefs.GetNumSamples() > 0)
 		state = beliefs.GetSample(0);
+	else
+		state = sample = beliefs.CreateSample(Simulator);
 
 	// Delete old tree and create new root
 	VNODE::Free(Root, Simulator);
 	VNODE* newRoot = ExpandNode(state);
+	if (sample)
+		Simulator.FreeState(sample);
 	newRoot->Beliefs() = beliefs;
 	Root = newRoot;
+	if (Params.CompactBelief)
+		Root->Beliefs().Compact(Simulator);
 	return true;
 }
 
+void MCTS::Restore(const HISTORY& history, BELIEF_STATE& beliefs, VNODE* root)
+{
+	StopPondering();
+	VNODE::Free(Root, Simulator);
+	History = history;
+	if (!root)
+	{
+		STATE* sample = beliefs.CreateSample(Simulator);
+		root = ExpandNode(sample);
+		Simulator.FreeState(sample);
+	}
+	Root = root;
+	Root->Beliefs().Move(beliefs);
+}
+
 int MCTS::SelectAction(const std::vector<double>& cumulativeReward)
 {
-	if (Params.DisableTree)
-		RolloutSearch();
+	int action;
+	if (Params.EnsembleMode != "none")
+		action = EnsembleSearch(cumulativeReward);
 	else
-		UCTSearch(cumulativeReward);
-	return GreedyUCB(Root, false, cumulativeReward);
+	{
+		int bookNode = Book && !Params.DisableTree ? Book->Find(History) : -1;
+		if (bookNode >= 0)
+			Book->Apply(bookNode, Root);
+
+		bool skipped = false;
+		if (Params.DisableTree)
+			RolloutSearch();
+		else if (Params.DecisionCache && WarmStart(cumulativeReward))
+		{
+			RootChoice = -1;
+			skipped = true;
+		}
+		else
+		{
+			UCTSearch(cumulativeReward);
+			if (Params.DecisionCache)
+				StoreDecision(cumulativeReward);
+		}
+		action = RootChoice >= 0 && !Params.DisableTree
+			? RootChoice : GreedyUCB(Root, false, cumulativeReward);
+		if (skipped)
+			GatherParticles(action, Params.NumSimulations);
+	}
+	if (Params.Ponder && !Params.DisableTree)
+		StartPondering(action, cumulativeReward);
+	return action;
+}
+
+bool MCTS::SaveBook()
+{
+	// The ponder thread may still be growing the tree. A book is saved once
+	// per experiment, so losing that step's pondering is cheap
+	StopPondering();
+	return OPENING_BOOK::Save(Params.SaveBook, Root, Params.BookDepth, Params.OpenLoop);
+}
+
+void MCTS::StartPondering(int action, const std::vector<double>& cumulativeReward)
+{
+	StopPondering();
+	if (!Ponderer)
+	{
+		PARAMS ponderParams = Params;
+		ponderParams.Ponder = false;
+		ponderParams.NumStartStates = 0;
+		ponderParams.AnalyticBelief = false;
+		ponderParams.EnsembleMode = "none";
+		ponderParams.DecisionCache = false;
+		ponderParams.RolloutCacheSize = 0;
+		ponderParams.SaveBook.clear();
+		Ponderer.reset(new MCTS(Simulator, ponderParams));
+		Ponderer->RolloutCache = RolloutCache;
+		VNODE::Free(Ponderer->Root, Simulator);
+	}
+	Ponderer->Root = Root;
+	Ponderer->History = History;
+	Ponderer->Status = Status;
+	PonderStop = false;
+	PonderThread = std::thread(&MCTS::Ponder, this, action, cumulativeReward, (unsigned int) RandomInt());
+}
+
+void MCTS::StopPondering()
+{
+	if (!PonderThread.joinable())
+		return;
+	PonderStop = true;
+	PonderThread.join();
+	Ponderer->Root = 0;
+	if (Params.Verbose >= 1)
+		cout << "Pondered " << PonderSimulations << " simulations" << endl;
+}
+
+void MCTS::Ponder(int action, std::vector<double> cumulativeReward, unsigned int seed)
+{
+	// Only this thread touches the tree and Simulator until StopPondering,
+	// the caller steps its own (real) simulator in the meantime
+	RANDOM_STREAM stream(seed);
+	MCTS& search = *Ponderer;
+	int historyDepth = search.History.Size();
+	QNODE& qnode = search.Root->Child(action);
+	bool addSamples = !Params.OpenLoop && !search.Root->GetBeliefs().GetAnalytic();
+
+	// Simulations start below the chosen action, so the root statistics
+	// the action was chosen from are left as they were
+	for (PonderSimulations = 0; PonderSimulations < Params.NumSimulations && !PonderStop; PonderSimulations++)
+	{
+		STATE* state = search.Root->GetBeliefs().CreateSample(Simulator);
+		Simulator.Validate(*state);
+		search.Status.Phase = SIMULATOR::STATUS::TREE;
+
+		int observation;
+		vector<double> reward(2, 0.0);
+		bool terminal = Simulator.Step(*state, action, observation, reward);
+		search.History.Add(action, observation);
+		if (!terminal)
+		{
+			VNODE*& vnode = qnode.Child(search.ChildIndex(observation));
+			if (!vnode)
+				vnode = search.ExpandNode(state);
+
+			// A reward ends the simulation, as in Simulate
+			if (accumulate(reward.begin(), reward.end(), 0.0) > 0)
+			{
+				if (addSamples)
+					search.AddSample(vnode, *state);
+			}
+			else
+			{
+				vector<double> cumulative = cumulativeReward;
+				for (int i = 0; i < 2; i++)
+					cumulative[i] += reward[i];
+				search.TreeDepth = 1;
+				search.PeakTreeDepth = 1;
+				search.Simulate(*state, vnode, cumulative, -1);
+			}
+		}
+
+		Simulator.FreeState(state);
+		search.History.Truncate(historyDepth);
+	}
+	search.TreeDepth = 0;
+}
+
+int MCTS::EnsembleSearch(const std::vector<double>& cumulativeReward)
+{
+	// Independent smaller searches, each with its own particle subset,
+	// random stream and thread, sharing nothing but the node pools
+	int ensembleSize = Params.EnsembleSize;
+	PARAMS memberParams = Params;
+	memberParams.NumSimulations = max(1, Params.NumSimulations / ensembleSize);
+	memberParams.NumStartStates = 0;
+	memberParams.EnsembleMode = "none";
+	memberParams.Ponder = false;
+	memberParams.AnalyticBelief = false;
+	memberParams.DecisionCache = false;
+	memberParams.RolloutCacheSize = 0;
+	memberParams.SaveBook.clear();
+
+	// Knowledge priors of the member roots, removed again when pooling
+	std::vector<std::vector<VALUE<int> > > priors(ensembleSize);
+
+	const BELIEF_STATE& beliefs = Root->GetBeliefs();
+	std::vector<MCTS*> members(ensembleSize);
+	std::vector<unsigned int> seeds(ensembleSize);
+	for (int m = 0; m < ensembleSize; m++)
+	{
+		MCTS* member = new MCTS(Simulator, memberParams);
+		member->RolloutCache = RolloutCache;
+		member->History = History;
+		member->Status = Status;
+
+		BELIEF_STATE subset;
+		if (beliefs.GetNumSamples() < ensembleSize)
+			subset.Copy(beliefs, Simulator);
+		else
+			for (int i = m; i < beliefs.GetNumSamples(); i += ensembleSize)
+			{
+				STATE* sample = Simulator.Copy(*beliefs.GetSample(i));
+				if (beliefs.GetCount(i) == 1)
+					subset.AddSample(sample);
+				else
+					subset.AddSample(sample, beliefs.GetCount(i));
+			}
+
+		STATE* state = subset.CreateSample(Simulator);
+		VNODE::Free(member->Root, Simulator);
+		member->Root = member->ExpandNode(state);
+		member->Root->Beliefs() = subset;
+		Simulator.FreeState(state);
+		for (int action = 0; action < Simulator.GetNumActions(); action++)
+			priors[m].push_back(member->Root->Child(action).Value);
+		priors[m].push_back(member->Root->Value);
+
+		members[m] = member;
+		seeds[m] = RandomInt();
+	}
+
+	std::vector<std::thread> threads;
+	for (int m = 0; m < ensembleSize; m++)
+	{
+		threads.push_back(std::thread([&, m]()
+		{
+			RANDOM_STREAM stream(seeds[m]);
+			if (Params.DisableTree)
+				members[m]->RolloutSearch();
+			else
+				members[m]->UCTSearch(cumulativeReward);
+		}));
+	}
+	for (int m = 0; m < ensembleSize; m++)
+		threads[m].join();
+
+	// Pool root statistics and depth-1 particles into this tree, counting
+	// only the members' own simulations
+	auto addSearched = [](VALUE<int>& value, const VALUE<int>& member, const VALUE<int>& prior)
+	{
+		int count = member.GetCount() - prior.GetCount();
+		if (count <= 0 || member.GetCount() >= LargeInteger)
+			return;
+		std::vector<double> mean = member.GetValue(), priorMean = prior.GetValue();
+		for (int i = 0; i < 2; i++)
+			mean[i] = (mean[i] * member.GetCount() - priorMean[i] * prior.GetCount()) / count;
+		value.Add(mean, count);
+	};
+	std::vector<int> votes(Simulator.GetNumActions(), 0);
+	for (int m = 0; m < ensembleSize; m++)
+	{
+		MCTS* member = members[m];
+		votes[GreedyUCB(member->Root, false, cumulativeReward)]++;
+		for (int action = 0; action < Simulator.GetNumActions(); action++)
+		{
+			QNODE& qnode = Root->Child(action);
+			QNODE& memberQnode = member->Root->Child(action);
+			addSearched(qnode.Value, memberQnode.Value, priors[m][action]);
+
+			for (int observation = 0; observation < QNODE::NumChildren; observation++)
+			{
+				VNODE* memberVnode = memberQnode.Child(observation);
+				if (!memberVnode || memberVnode->GetBeliefs().Empty())
+					continue;
+				VNODE*& vnode = qnode.Child(observation);
+				if (!vnode)
+				{
+					History.Add(action, observation);
+					vnode = ExpandNode(memberVnode->GetBeliefs().GetSample(0));
+					History.Truncate(History.Size() - 1);
+				}
+				vnode->Beliefs().Move(memberVnode->Beliefs());
+			}
+		}
+		addSearched(Root->Value, member->Root->Value, priors[m].back());
+		delete member;
+	}
+
+	if (Params.EnsembleMode != "vote")
+		return GreedyUCB(Root, false, cumulativeReward);
+
+	// Majority vote, ties broken by the pooled values
+	int mostVotes = *max_element(votes.begin(), votes.end());
+	int besta = -1;
+	double bestq = -Infinity;
+	for (int action = 0; action < Simulator.GetNumActions(); action++)
+	{
+		if (votes[action] < mostVotes)
+			continue;
+		std::vector<double> q = Root->Child(action).Value.GetValue();
+		if (Params.ConsiderPast)
+			for (int i = 0; i < 2; i++)
+				q[i] += cumulativeReward[i];
+		double a = Scalarise(q);
+		if (besta < 0 || a > bestq)
+		{
+			besta = action;
+			bestq = a;
+		}
+	}
+	return besta;
 }
 
 void MCTS::RolloutSearch()
 {
-	std::vector<double> totals(Simulator.GetNumActions(), 0.0);
+	PROFILE_SCOPE(SEARCH);
 	int historyDepth = History.Size();
+	int numActions = Simulator.GetNumActions();
+	int numObservations = Simulator.GetNumObservations();
 	std::vector<int> legal;
-	assert(BeliefState().GetNumSamples() > 0);
-	Simulator.GenerateLegal(*BeliefState().GetSample(0), GetHistory(), legal, GetStatus());
+	assert(!BeliefState().Empty());
+	STATE* sample = BeliefState().CreateSample(Simulator);
+	Simulator.GenerateLegal(*sample, GetHistory(), legal, GetStatus());
+	Simulator.FreeState(sample);
 	random_shuffle(legal.begin(), legal.end());
-	for (int i = 0; i < Params.NumSimulations; i++)
+
+	// Per-thread accumulators, merged into the root after each round
+	struct ACCUMULATOR
 	{
-		int action = legal[i % legal.size()];
-		STATE* state = Root->Beliefs().CreateSample(Simulator);
-		Simulator.Validate(*state);
+		std::vector<double> Totals;
+		std::vector<int> Counts;
+		std::vector<STATE*> FirstStates; // one particle per (action, observation)
+		HISTORY History;
+		SIMULATOR::STATUS Status;
+		STATISTIC RolloutDepth;
+	};
+	int numThreads = max(1, Params.NumThreads);
+	std::vector<ACCUMULATOR> accumulators(numThreads);
+	std::vector<unsigned int> seeds(numThreads);
+	bool keepParticles = !Params.OpenLoop && !Root->GetBeliefs().GetAnalytic();
+
+	// The adaptive budget applies as in UCTSearch, without the early stop
+	int totalBudget = Params.AdaptiveBudget ? StepBudget() : Params.NumSimulations;
+	vector<int> startCounts;
+	if (Params.AdaptiveBudget)
+		for (int a = 0; a < numActions; a++)
+			startCounts.push_back(Root->Child(a).Value.GetCount());
+
+	// Successive halving splits the budget evenly over log2(|legal|) rounds,
+	// keeping the better half of the actions after each round
+	std::vector<int> active = legal;
+	int numRounds = 1;
+	if (Params.SuccessiveHalving)
+		while ((1 << numRounds) < (int) legal.size())
+			numRounds++;
+
+	for (int round = 0; round < numRounds; round++)
+	{
+		int budget = round < numRounds - 1
+			? totalBudget / numRounds
+			: totalBudget - round * (totalBudget / numRounds);
 
-		int observation;
-		std::vector<double> immediateReward(2, 0.0), delayedReward(2, 0.0), totalReward(2, 0.0);
-		bool terminal = Simulator.Step(*state, action, observation, immediateReward);
+		for (int t = 0; t < numThreads; t++)
+		{
+			ACCUMULATOR& acc = accumulators[t];
+			acc.Totals.assign(numActions * 2, 0.0);
+			acc.Counts.assign(numActions, 0);
+			acc.FirstStates.assign(numActions * numObservations, 0);
+			acc.History = History;
+			acc.Status = Status;
+			seeds[t] = RandomInt();
+		}
 
-		VNODE*& vnode = Root->Child(action).Child(observation);
-		if (!vnode && !terminal)
+		auto worker = [&](int t)
 		{
-			vnode = ExpandNode(state);
-			AddSample(vnode, *state);
+			ACCUMULATOR& acc = accumulators[t];
+			std::vector<double> immediateReward(2, 0.0), delayedReward(2, 0.0);
+			for (int i = t; i < budget; i += numThreads)
+			{
+				PROFILE_SCOPE(TREE);
+				int action = active[i % active.size()];
+				STATE* state = Root->GetBeliefs().CreateSample(Simulator);
+				Simulator.Validate(*state);
+
+				int observation, steps;
+				bool terminal;
+				{
+					PROFILE_SCOPE(STEP);
+					terminal = Simulator.MacroStep(*state, action, observation, immediateReward, steps);
+				}
+				STATE*& first = acc.FirstStates[action * numObservations + observation];
+				if (keepParticles && !first && !terminal && !Root->Child(action).Child(observation))
+					first = Simulator.Copy(*state);
+				acc.History.Add(action, observation);
+
+				delayedReward = Rollout(*state, acc.History, acc.Status, TreeDepth, acc.RolloutDepth);
+
+				for (int i = 0; i < 2; i++){
+					acc.Totals[action * 2 + i] += immediateReward[i]
+						+ pow(Simulator.GetDiscount(), steps) * delayedReward[i];
+				}
+				acc.Counts[action]++;
+
+				Simulator.FreeState(state);
+				acc.History.Truncate(historyDepth);
+			}
+		};
+
+		if (numThreads == 1)
+			worker(0);
+		else
+		{
+			std::vector<std::thread> threads;
+			for (int t = 0; t < numThreads; t++)
+			{
+				threads.push_back(std::thread([&, t]()
+				{
+					RANDOM_STREAM stream(seeds[t]);
+					worker(t);
+				}));
+			}
+			for (int t = 0; t < numThreads; t++)
+				threads[t].join();
 		}
-		History.Add(action, observation);
 
-		delayedReward = Rollout(*state);
+		for (int t = 0; t < numThreads; t++)
+		{
+			ACCUMULATOR& acc = accumulators[t];
+			for (int action = 0; action < numActions; action++)
+			{
+				if (acc.Counts[action] > 0)
+				{
+					std::vector<double> mean(2);
+					for (int i = 0; i < 2; i++)
+						mean[i] = acc.Totals[action * 2 + i] / acc.Counts[action];
+					Root->Child(action).Value.Add(mean, acc.Counts[action]);
+				}
+
+				for (int observation = 0; observation < numObservations; observation++)
+				{
+					STATE* state = acc.FirstStates[action * numObservations + observation];
+					if (!state)
+						continue;
+					VNODE*& vnode = Root->Child(action).Child(observation);
+					if (vnode)
+					{
+						Simulator.FreeState(state);
+						continue;
+					}
+					History.Add(action, observation);
+					vnode = ExpandNode(state);
+					History.Truncate(historyDepth);
+					vnode->Beliefs().AddSample(state);
+				}
+			}
+		}
 
-		// totalReward = immediateReward + Simulator.GetDiscount() * delayedReward;
-		for (int i = 0; i < 2; i++){
-			totalReward[i] = immediateReward[i] + Simulator.GetDiscount() * delayedReward[i];
+		if (round < numRounds - 1)
+		{
+			std::vector<std::pair<double, int> > scores;
+			for (int i = 0; i < (int) active.size(); i++)
+			{
+				std::vector<double> q = Root->Child(active[i]).Value.GetValue();
+				double a = Scalarise(q);
+				scores.push_back(std::make_pair(-a, active[i]));
+			}
+			std::stable_sort(scores.begin(), scores.end());
+			active.resize((active.size() + 1) / 2);
+			for (int i = 0; i < (int) active.size(); i++)
+				active[i] = scores[i].second;
 		}
-		Root->Child(action).Value.Add(totalReward);
+	}
 
-		Simulator.FreeState(state);
-		History.Truncate(historyDepth);
+	if (Params.AdaptiveBudget)
+	{
+		LastConcentration = RootConcentration(startCounts);
+		BudgetBank += Params.NumSimulations - totalBudget;
+		StatSimulations.Add(totalBudget);
 	}
 }
 
 void MCTS::UCTSearch(const std::vector<double>& realCumulativeRew)
 {
+	PROFILE_SCOPE(SEARCH);
 	ClearStatistics();
 	int historyDepth = History.Size();
 
-	for (int n = 0; n < Params.NumSimulations; n++)
+	int budget = Params.AdaptiveBudget ? StepBudget() : Params.NumSimulations;
+
+	// Simple-regret allocation of simulations to root actions; UCB still
+	// selects actions below the root
+	std::unique_ptr<Bandit> allocator;
+	std::vector<int> legal;
+	RootChoice = -1;
+	if (Params.RootAllocator != "ucb")
 	{
-		STATE* state = Root->Beliefs().CreateSample(Simulator);
+		STATE* sample = Root->GetBeliefs().CreateSample(Simulator);
+		Simulator.GenerateLegal(*sample, History, legal, Status);
+		Simulator.FreeState(sample);
+		if (Params.RootAllocator == "halving")
+			allocator.reset(new SequentialHalving(Simulator.GetNumActions(),
+				Params.BanditArmCapacity, budget));
+		else
+			allocator.reset(new TopTwoThompsonSampling(Simulator.GetNumActions(),
+				Params.BanditArmCapacity, Params.BanditBetaPrior));
+	}
+	// The allocators' priors assume returns of order one
+	double rewardScale = Simulator.GetRewardRange() > 0 ? 1.0 / Simulator.GetRewardRange() : 1.0;
+
+	int minSimulations = budget / 4, checkInterval = max(budget / 16, 1);
+	vector<int> startCounts;
+	if (Params.AdaptiveBudget)
+		for (int a = 0; a < Simulator.GetNumActions(); a++)
+			startCounts.push_back(Root->Child(a).Value.GetCount());
+
+	// Simulations run on the particle itself and undo their steps afterwards,
+	// or else overwrite one scratch state with the sampled particle rather
+	// than allocating a copy, when the simulator supports it
+	Undoing = Params.UndoSimulation && Simulator.CanUndo() && !Root->GetBeliefs().GetAnalytic();
+	STATE* scratch = Undoing ? 0 : Root->GetBeliefs().CreateSample(Simulator);
+	bool reuseScratch = !Undoing;
+
+	int n;
+	for (n = 0; n < budget; n++)
+	{
+		// Stop once the root decision has settled
+		if (Params.AdaptiveBudget && n >= minSimulations && n % checkInterval == 0
+			&& RootConcentration(startCounts) >= Params.BudgetConcentration)
+			break;
+
+		STATE* state;
+		int undoMark = Simulator.UndoMark();
+		if (Undoing)
+			state = Root->Beliefs().SelectSample();
+		else
+		{
+			PROFILE_SCOPE(COPY);
+			reuseScratch = reuseScratch && Root->GetBeliefs().SampleInto(Simulator, *scratch);
+			state = reuseScratch ? scratch : Root->GetBeliefs().CreateSample(Simulator);
+		}
 		Simulator.Validate(*state);
 		Status.Phase = SIMULATOR::STATUS::TREE;
 		// cout << "Starting simulation #" << n << endl; 
@@ -179,7 +761,16 @@ void MCTS::UCTSearch(const std::vector<double>& realCumulativeRew)
 		TreeDepth = 0;
 		PeakTreeDepth = 0;
         vector<double> tempCumulativeRew = realCumulativeRew;
-		std::vector<double> totalReward = SimulateV(*state, Root, tempCumulativeRew, false);
+		int rootAction = allocator ? allocator->sampleFrom(legal) : -1;
+		std::vector<double> totalReward = Simulate(*state, Root, tempCumulativeRew, rootAction);
+		if (allocator)
+		{
+			std::vector<double> q = totalReward;
+			if (Params.ConsiderPast)
+				for (int i = 0; i < 2; i++)
+					q[i] += realCumulativeRew[i];
+			allocator->update(Scalarise(q) * rewardScale);
+		}
 		StatTotalReward.Add(totalReward);	
 		StatTreeDepth.Add(PeakTreeDepth);
 		// cout << "Total reward = " << "[" << totalReward[0] << ", " <<totalReward[1] << "]" << endl;
@@ -189,111 +780,175 @@ void MCTS::UCTSearch(const std::vector<double>& realCumulativeRew)
 		if (Params.Verbose >= 3)
 			DisplayValue(4, cout);
 
-		Simulator.FreeState(state);
+		{
+			PROFILE_SCOPE(FREE);
+			if (Undoing)
+				Simulator.Undo(*state, undoMark);
+			else if (state != scratch)
+				Simulator.FreeState(state);
+		}
 		History.Truncate(historyDepth);
 	}
+	Undoing = false;
+	if (scratch)
+		Simulator.FreeState(scratch);
 
+	if (Params.AdaptiveBudget)
+	{
+		LastConcentration = RootConcentration(startCounts);
+		BudgetBank += Params.NumSimulations - n;
+		StatSimulations.Add(n);
+	}
+	if (allocator)
+	{
+		// Only a legal arm that was actually played overrides the greedy choice
+		RootChoice = allocator->play();
+		if (RootChoice < 0 || std::find(legal.begin(), legal.end(), RootChoice) == legal.end()
+			|| allocator->getArm(RootChoice)->size() == 0)
+			RootChoice = -1;
+	}
 	DisplayStatistics(cout);
 }
 
-std::vector<double> MCTS::SimulateV(STATE& state, VNODE* vnode, std::vector<double> realCumulativeRew, bool foundOneRock)
+int MCTS::StepBudget() const
+{
+	// Hard steps have a spread belief or an unsettled previous decision
+	double hardness = 0.5 * BeliefEntropy() + 0.5 * (1.0 - LastConcentration);
+	int budget = Params.NumSimulations * (0.25 + 1.5 * hardness);
+	return max(min(budget, Params.NumSimulations + max(BudgetBank, 0)), 1);
+}
+
+double MCTS::BeliefEntropy() const
 {
-	PeakTreeDepth = TreeDepth;
-	if (TreeDepth >= Params.MaxDepth) // search horizon reached
+	// Normalised entropy of the hashed states of a few belief samples,
+	// 1 when the simulator cannot hash its states
+	static const int NUM_SAMPLES = 64;
+	std::unordered_map<std::size_t, int> histogram;
+	for (int i = 0; i < NUM_SAMPLES; i++)
 	{
-		cout << "search horizon reached!" << endl;
-		return {0.0, 0.0};
-	}
-	if (TreeDepth == 1)
-		AddSample(vnode, state);
-	if (foundOneRock) {
-		return {0.0, 0.0};
+		STATE* sample = Root->GetBeliefs().CreateSample(Simulator);
+		std::size_t hash;
+		bool hashed = Simulator.HashState(*sample, hash);
+		Simulator.FreeState(sample);
+		if (!hashed)
+			return 1.0;
+		histogram[hash]++;
 	}
 
-	int action = GreedyUCB(vnode, true, realCumulativeRew);
-	// cout << "[TREE SEARCH]: select action " << action << endl;
+	double entropy = 0;
+	for (const auto& entry : histogram)
+	{
+		double p = (double) entry.second / NUM_SAMPLES;
+		entropy -= p * log(p);
+	}
+	return entropy / log((double) NUM_SAMPLES);
+}
 
-	QNODE& qnode = vnode->Child(action);
-	// double totalReward = SimulateQ(state, qnode, action);
-	vector<double> totalReward = SimulateQ(state, qnode, action, realCumulativeRew);
-	vnode->Value.Add(totalReward);
-	// AddRave(vnode, totalReward);
-	return totalReward;
+double MCTS::RootConcentration(const vector<int>& startCounts) const
+{
+	// Share of this search's root visits taken by the most visited action
+	int total = 0, best = 0;
+	for (int a = 0; a < Simulator.GetNumActions(); a++)
+	{
+		int visits = Root->Child(a).Value.GetCount() - startCounts[a];
+		total += visits;
+		best = max(best, visits);
+	}
+	return total > 0 ? (double) best / total : 0.0;
 }
 
-std::vector<double> MCTS::SimulateQ(STATE& state, QNODE& qnode, int action, std::vector<double> realCumulativeRew)
+std::vector<double> MCTS::Simulate(STATE& state, VNODE* vnode, std::vector<double> realCumulativeRew, int rootAction)
 {
-	int observation;
-	// double immediateReward, delayedReward = 0;
-	vector<double> immediateReward(2, 0.0), delayedReward(2, 0.0);
+	// Descend iteratively, recording the visited (vnode, action) pairs in Path,
+	// then back the rewards up along the path in a single pass
+	PROFILE_SCOPE(TREE);
+	int rootDepth = TreeDepth;
+	std::vector<double> delayedReward(2, 0.0);
+	bool foundOneRock = false;
+	PathLength = 0;
+
+	while (true)
+	{
+		PeakTreeDepth = TreeDepth;
+		if (TreeDepth >= Params.MaxDepth) // search horizon reached
+		{
+			cout << "search horizon reached!" << endl;
+			break;
+		}
+		if (TreeDepth == 1 && !Params.OpenLoop && !Root->GetBeliefs().GetAnalytic())
+			AddSample(vnode, state);
+		if (foundOneRock)
+			break;
 
-	if (Simulator.HasAlpha())
-		Simulator.UpdateAlpha(qnode, state);
-	bool terminal = Simulator.Step(state, action, observation, immediateReward);
-	for (int i = 0; i < 2; i++) {
-		realCumulativeRew[i] += immediateReward[i];
-	}
-	assert(observation >= 0 && observation < Simulator.GetNumObservations());
-	History.Add(action, observation);
+		int action = rootAction >= 0 && PathLength == 0
+			? rootAction : GreedyUCB(vnode, true, realCumulativeRew);
+		QNODE& qnode = vnode->Child(action);
 
-    // bool foundOneRock = (accumulate(immediateReward.begin(), immediateReward.end(), 0.0) > 0);
-    // // if sample a rock, then return
-    // if (foundOneRock) {
-    //     // cout << "[TREE] find a rock with reward " << immediateReward;
-    //     std::vector<double> totalReward(2, 0.0);
-    //     for (int i = 0; i < 2; i++){
-    //         totalReward[i] = immediateReward[i] + Simulator.GetDiscount() * delayedReward[i];
-    //     }
-    //     qnode.Value.Add(totalReward);
-    //     return totalReward;
-    // }
+		if (PathLength == (int) Path.size())
+			Path.push_back(PATH_ENTRY());
+		PATH_ENTRY& entry = Path[PathLength++];
+		entry.VNode = vnode;
+		entry.QNode = &qnode;
+		entry.Action = action;
 
-	if (Params.Verbose >= 3)
-	{
-		Simulator.DisplayAction(action, cout);
-		Simulator.DisplayObservation(state, observation, cout);
-		Simulator.DisplayVectorReward(immediateReward, cout);
-		Simulator.DisplayState(state, cout);
-	}
+		int observation;
+		if (Simulator.HasAlpha())
+			Simulator.UpdateAlpha(qnode, state);
+		bool terminal;
+		{
+			PROFILE_SCOPE(STEP);
+			terminal = Undoing
+				? Simulator.StepUndoable(state, action, observation, entry.Reward, entry.Steps)
+				: Simulator.MacroStep(state, action, observation, entry.Reward, entry.Steps);
+		}
+		for (int i = 0; i < 2; i++) {
+			realCumulativeRew[i] += entry.Reward[i];
+		}
+		assert(observation >= 0 && observation < Simulator.GetNumObservations());
+		History.Add(action, observation);
 
-	VNODE*& vnode = qnode.Child(observation);
-	if (!vnode && !terminal && qnode.Value.GetCount() >= Params.ExpandCount)
-	{
-		vnode = ExpandNode(&state);
-	}
+		if (Params.Verbose >= 3)
+		{
+			Simulator.DisplayAction(action, cout);
+			Simulator.DisplayObservation(state, observation, cout);
+			Simulator.DisplayVectorReward(entry.Reward, cout);
+			Simulator.DisplayState(state, cout);
+		}
 
-    bool foundOneRock = (accumulate(immediateReward.begin(), immediateReward.end(), 0.0) > 0);
-	// if (foundOneRock) cout << "immediate reward: " << immediateReward << endl;
-    // if sample a rock, then return
-    // if (foundOneRock) {
-    //     // cout << "[TREE] find a rock with reward " << immediateReward;
-    //     std::vector<double> totalReward(2, 0.0);
-    //     for (int i = 0; i < 2; i++){
-    //         totalReward[i] = immediateReward[i] + Simulator.GetDiscount() * delayedReward[i];
-    //     }
-    //     qnode.Value.Add(totalReward);
-    //     return totalReward;
-    // }
+		VNODE*& child = qnode.Child(ChildIndex(observation));
+		if (!child && !terminal && qnode.Value.GetCount() >= Params.ExpandCount)
+			child = ExpandNode(&state);
+
+		// if sample a rock, the next vnode stops the simulation
+		foundOneRock = (accumulate(entry.Reward.begin(), entry.Reward.end(), 0.0) > 0);
+
+		if (terminal)
+			break;
 
-	if (!terminal)
-	{
 		TreeDepth++;
-		if (vnode) {
-			delayedReward = SimulateV(state, vnode, realCumulativeRew, foundOneRock);
-		}
-		else {
+		if (!child)
+		{
 			delayedReward = Rollout(state);
+			break;
 		}
-		TreeDepth--;
+		vnode = child;
 	}
 
-	// double totalReward = immediateReward + Simulator.GetDiscount() * delayedReward;
-	std::vector<double> totalReward(2, 0.0);
-	for (int i = 0; i < 2; i++){
-		totalReward[i] = immediateReward[i] + Simulator.GetDiscount() * delayedReward[i];
+	std::vector<double>& totalReward = delayedReward;
+	for (int d = PathLength - 1; d >= 0; d--)
+	{
+		PATH_ENTRY& entry = Path[d];
+		double discount = entry.Steps == 1
+			? Simulator.GetDiscount() : pow(Simulator.GetDiscount(), entry.Steps);
+		for (int i = 0; i < 2; i++){
+			totalReward[i] = entry.Reward[i] + discount * totalReward[i];
+		}
+		entry.QNode->Value.Add(totalReward);
+		entry.VNode->Value.Add(totalReward);
+		if (Params.Mast)
+			Mast->Add(entry.Action, totalReward);
 	}
-	// qnode.Value.AddCumulatedReward(cumulatedReward);
-	qnode.Value.Add(totalReward);
+	TreeDepth = rootDepth;
 	return totalReward;
 }
 
@@ -328,6 +983,7 @@ VNODE* MCTS::ExpandNode(const STATE* state)
 
 void MCTS::AddSample(VNODE* node, const STATE& state)
 {
+	PROFILE_SCOPE(COPY);
 	STATE* sample = Simulator.Copy(state);
 	node->Beliefs().AddSample(sample);
 	if (Params.Verbose >= 2)
@@ -337,51 +993,62 @@ void MCTS::AddSample(VNODE* node, const STATE& state)
 	}
 }
 
-int MCTS::GreedyUCB(VNODE* vnode, bool ucb, const std::vector<double> cumulativeReward) const
+struct MCTS::GGF_SCALARISATION
+{
+	static double Apply(const std::vector<double>& q) { return GGF(q); }
+};
+
+struct MCTS::WS_SCALARISATION
 {
-	static vector<int> besta;
+	static double Apply(const std::vector<double>& q) { return WS(q); }
+};
+
+struct MCTS::UCB1_BONUS
+{
+	static double Apply(const MCTS& mcts, int N, double logN, const QNODE& qnode)
+	{
+		return mcts.FastUCB(N, qnode.Value.GetCount(), logN);
+	}
+};
+
+// UCB-V: the confidence width scales with the empirical variance of the returns
+struct MCTS::UCBV_BONUS
+{
+	static double Apply(const MCTS& mcts, int, double logN, const QNODE& qnode)
+	{
+		int n = qnode.Value.GetCount();
+		if (n == 0)
+			return Infinity;
+		double range = mcts.Simulator.GetRewardRange();
+		if (range <= 0)
+			range = 1;
+		return mcts.Params.ExplorationConstant / range * sqrt(2 * qnode.Value.GetVariance() * logN / n)
+			+ mcts.Params.ExplorationConstant * 3 * logN / n;
+	}
+};
+
+template <class SCALARISATION, class BONUS>
+int MCTS::SelectScalarised(VNODE* vnode, bool ucb, const std::vector<double>& cumulativeReward) const
+{
+	static thread_local vector<int> besta;
 	besta.clear();
 	double bestq = -Infinity;
 	int N = vnode->Value.GetCount();
 	double logN = log(N + 1);
-	bool hasalpha = Simulator.HasAlpha();
-
-	// if (ucb) cout << "--------------ucb---------------" << endl;
-	// else cout << "***************no-ucb*************" << endl;
-
 
 	for (int action = 0; action < Simulator.GetNumActions(); action++)
 	{
-		std::vector<double> q;
-		double a;
-		double alphaq;
-		int n, alphan;
-
 		QNODE& qnode = vnode->Child(action);
-		q = qnode.Value.GetValue();
-		n = qnode.Value.GetCount();
-
-        // cout << "action " << action << ", visit count = " << n << ", Q value: " << q << endl;
+		std::vector<double> q = qnode.Value.GetValue();
 
 		if (Params.ConsiderPast) {
-            // cout << "cumulative reward: " << cumulativeReward << endl;
 			for (int i = 0; i < 2; i++) {
 				q[i] += cumulativeReward[i];
 			}
 		}
 
-		if (Params.Strategy == "GGF") {
-			a = GGF(q); // GGF criteria
-            // cout << "GGF score = " << a << endl;
-		}
-		else {
-			a = WS(q); // weighted sum
-            // cout << "WS score = " << a << endl;
-		}
-        // cout << "exploration term: " << FastUCB(N, n, logN) << endl;
-
-		if (ucb) a += FastUCB(N, n, logN);
-		// cout << "a = " << a << endl;
+		double a = SCALARISATION::Apply(q);
+		if (ucb) a += BONUS::Apply(*this, N, logN, qnode);
 
 		if (a >= bestq)
 		{
@@ -395,26 +1062,105 @@ int MCTS::GreedyUCB(VNODE* vnode, bool ucb, const std::vector<double> cumulative
 	return besta[Random(besta.size())];
 }
 
+// Pareto UCB: choose uniformly among actions whose optimistic value vectors
+// are not dominated by any other action's
+template <class SCALARISATION, class BONUS>
+int MCTS::SelectPareto(VNODE* vnode, bool ucb, const std::vector<double>& cumulativeReward) const
+{
+	if (!ucb)
+		return SelectScalarised<SCALARISATION, BONUS>(vnode, ucb, cumulativeReward);
+
+	static thread_local vector<std::vector<double> > optimistic;
+	static thread_local vector<int> front;
+	int numActions = Simulator.GetNumActions();
+	int N = vnode->Value.GetCount();
+	double logN = log(N + 1);
+
+	optimistic.resize(numActions);
+	for (int action = 0; action < numActions; action++)
+	{
+		QNODE& qnode = vnode->Child(action);
+		optimistic[action] = qnode.Value.GetValue();
+		double bonus = BONUS::Apply(*this, N, logN, qnode);
+		for (int i = 0; i < 2; i++) {
+			optimistic[action][i] += bonus;
+			if (Params.ConsiderPast)
+				optimistic[action][i] += cumulativeReward[i];
+		}
+	}
+
+	front.clear();
+	for (int action = 0; action < numActions; action++)
+	{
+		bool dominated = false;
+		for (int other = 0; other < numActions && !dominated; other++)
+		{
+			const std::vector<double>& u = optimistic[action];
+			const std::vector<double>& v = optimistic[other];
+			dominated = v[0] >= u[0] && v[1] >= u[1] && (v[0] > u[0] || v[1] > u[1]);
+		}
+		if (!dominated)
+			front.push_back(action);
+	}
+	assert(!front.empty());
+	return front[Random(front.size())];
+}
+
 std::vector<double> MCTS::Rollout(STATE& state)
 {
-	Status.Phase = SIMULATOR::STATUS::ROLLOUT;
+	return Rollout(state, History, Status, TreeDepth, StatRolloutDepth);
+}
+
+std::vector<double> MCTS::Rollout(STATE& state, HISTORY& history,
+	SIMULATOR::STATUS& status, int treeDepth, STATISTIC& rolloutDepth) const
+{
+	PROFILE_SCOPE(ROLLOUT);
+	const SIMULATOR& simulator = Simulator;
+	status.Phase = SIMULATOR::STATUS::ROLLOUT;
 	if (Params.Verbose >= 3)
 		cout << "Starting rollout" << endl;
 
 	// double totalReward = 0.0;
 	std::vector<double> totalReward(2, 0.0);
+
+	std::uint64_t key;
+	bool cached = RolloutCache && simulator.RolloutKey(state, key);
+	if (cached && RolloutCache->Lookup(key, Params.RolloutCacheCount, totalReward))
+	{
+		rolloutDepth.Add(0);
+		return totalReward;
+	}
+
 	double discount = 1.0;
 	bool terminal = false;
 	int numSteps;
-	for (numSteps = 0; numSteps + TreeDepth < Params.MaxDepth && !terminal; ++numSteps)
+	int historyDepth = history.Size();
+	for (numSteps = 0; numSteps + treeDepth < Params.MaxDepth && !terminal; ++numSteps)
 	{
 		int observation;
 		std::vector<double> reward(2, 0.0);
 
-		int action = Simulator.SelectRandom(state, History, Status);
+		if (Params.LeafDepth >= 0 && numSteps >= Params.LeafDepth
+			&& simulator.LeafValue(state, reward))
+		{
+			for (int i = 0; i < 2; i++){
+				totalReward[i] += reward[i] * discount;
+			}
+			break;
+		}
+
+		int action = Params.Mast
+			? SelectMast(state, history, status)
+			: simulator.SelectRandom(state, history, status);
 		// cout << "[ROLLOUT]: select action " << action << endl;
-		terminal = Simulator.Step(state, action, observation, reward);
-		History.Add(action, observation);
+		int steps;
+		{
+			PROFILE_SCOPE(STEP);
+			terminal = Undoing
+				? simulator.StepUndoable(state, action, observation, reward, steps)
+				: simulator.MacroStep(state, action, observation, reward, steps);
+		}
+		history.Add(action, observation);
 
         bool foundOneRock = (accumulate(reward.begin(), reward.end(), 0.0) > 0);
 		// if (foundOneRock) cout << "immediate reward: " << reward << endl;
@@ -428,28 +1174,83 @@ std::vector<double> MCTS::Rollout(STATE& state)
 
 		if (Params.Verbose >= 4)
 		{
-			Simulator.DisplayAction(action, cout);
-			Simulator.DisplayObservation(state, observation, cout);
-			// Simulator.DisplayReward(reward, cout);
-			Simulator.DisplayVectorReward(reward, cout);
-			Simulator.DisplayState(state, cout);
+			simulator.DisplayAction(action, cout);
+			simulator.DisplayObservation(state, observation, cout);
+			// simulator.DisplayReward(reward, cout);
+			simulator.DisplayVectorReward(reward, cout);
+			simulator.DisplayState(state, cout);
 		}
 
 		// totalReward += reward * discount;
 		for (int i = 0; i < 2; i++){
 			totalReward[i] += reward[i] * discount;
 		}
-		discount *= Simulator.GetDiscount();
+		discount *= steps == 1 ? simulator.GetDiscount() : pow(simulator.GetDiscount(), steps);
 	}
-	StatRolloutDepth.Add(numSteps);
+	rolloutDepth.Add(numSteps);
+	if (Params.Mast)
+		for (int t = historyDepth; t < history.Size(); ++t)
+			Mast->Add(history[t].Action, totalReward);
+	if (cached)
+		RolloutCache->Add(key, totalReward);
 	if (Params.Verbose >= 3)
 		cout << "Ending rollout after " << numSteps
 		<< " steps, with total reward " << "[" << totalReward[0] << ", " << totalReward[1] << "]" << endl;
 	return totalReward;
 }
 
+int MCTS::SelectMast(const STATE& state, const HISTORY& history,
+	const SIMULATOR::STATUS& status) const
+{
+	static thread_local std::vector<int> legal;
+	static thread_local std::vector<double> scores;
+	legal.clear();
+	Simulator.GenerateLegal(state, history, legal, status);
+	assert(!legal.empty());
+
+	// Gibbs distribution over scalarised mean returns; untried actions are
+	// scored optimistically as the best tried action
+	std::vector<double> q;
+	double best = -Infinity;
+	scores.resize(legal.size());
+	for (int i = 0; i < (int) legal.size(); ++i)
+	{
+		if (Mast->GetValue(legal[i], q))
+		{
+			scores[i] = Scalarise(q);
+			best = max(best, scores[i]);
+		}
+		else
+			scores[i] = Infinity;
+	}
+	if (best == -Infinity)
+		return legal[Random(legal.size())];
+
+	double total = 0.0;
+	for (int i = 0; i < (int) legal.size(); ++i)
+	{
+		scores[i] = exp((min(scores[i], best) - best) / Params.MastTemperature);
+		total += scores[i];
+	}
+	double r = RandomDouble(0.0, total);
+	for (int i = 0; i < (int) legal.size(); ++i)
+	{
+		r -= scores[i];
+		if (r <= 0.0)
+			return legal[i];
+	}
+	return legal.back();
+}
+
 void MCTS::AddTransforms(VNODE* root, BELIEF_STATE& beliefs)
 {
+	PROFILE_SCOPE(TRANSFORMS);
+	if (Params.NumThreads > 1)
+	{
+		AddTransformsParallel(beliefs);
+		return;
+	}
+
 	int attempts = 0, added = 0;
 
 	// Local transformations of state that are consistent with history
@@ -471,12 +1272,156 @@ void MCTS::AddTransforms(VNODE* root, BELIEF_STATE& beliefs)
 	}
 }
 
+void MCTS::CreateStartStates(std::vector<STATE*>& states) const
+{
+	// Large particle sets are split between the worker threads, each batch
+	// drawn from its own seeded engine
+	static const int MinParallel = 4096;
+	int numThreads = Params.NumStartStates >= MinParallel ? Params.NumThreads : 1;
+	if (numThreads <= 1)
+	{
+		Simulator.CreateStartStates(Params.NumStartStates, states, RandomInt());
+		return;
+	}
+
+	std::vector<std::vector<STATE*> > batches(numThreads);
+	std::vector<unsigned int> seeds(numThreads);
+	for (int t = 0; t < numThreads; t++)
+		seeds[t] = RandomInt();
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t < numThreads; t++)
+	{
+		int count = Params.NumStartStates / numThreads
+			+ (t < Params.NumStartStates % numThreads ? 1 : 0);
+		threads.push_back(std::thread([&, t, count]
+		{
+			RANDOM_STREAM stream(seeds[t]);
+			Simulator.CreateStartStates(count, batches[t], seeds[t]);
+		}));
+	}
+	for (int t = 0; t < numThreads; t++)
+	{
+		threads[t].join();
+		states.insert(states.end(), batches[t].begin(), batches[t].end());
+	}
+}
+
+void MCTS::AddTransformsParallel(BELIEF_STATE& beliefs)
+{
+	// Workers claim attempts in batches and stop as soon as enough
+	// transforms have been accepted across all threads
+	static const int BatchSize = 64;
+	std::atomic<int> attempts(0), added(0);
+	std::vector<std::vector<STATE*> > accepted(Params.NumThreads);
+	std::vector<int> tried(Params.NumThreads, 0);
+	std::vector<unsigned int> seeds(Params.NumThreads);
+	for (int t = 0; t < Params.NumThreads; t++)
+		seeds[t] = RandomInt();
+
+	auto worker = [&](int t)
+	{
+		RANDOM_STREAM stream(seeds[t]);
+		while (added < Params.NumTransforms)
+		{
+			int first = attempts.fetch_add(BatchSize);
+			if (first >= Params.MaxAttempts)
+				break;
+			int last = min(first + BatchSize, Params.MaxAttempts);
+			for (int i = first; i < last && added < Params.NumTransforms; i++)
+			{
+				STATE* transform = CreateTransform();
+				tried[t]++;
+				if (!transform)
+					continue;
+				if (added.fetch_add(1) < Params.NumTransforms)
+					accepted[t].push_back(transform);
+				else
+					Simulator.FreeState(transform);
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (int t = 1; t < Params.NumThreads; t++)
+		threads.push_back(std::thread(worker, t));
+	worker(0);
+	for (int t = 0; t < (int) threads.size(); t++)
+		threads[t].join();
+
+	int numAdded = 0, numTried = 0;
+	for (int t = 0; t < Params.NumThreads; t++)
+	{
+		for (int i = 0; i < (int) accepted[t].size(); i++)
+			beliefs.AddSample(accepted[t][i]);
+		numAdded += accepted[t].size();
+		numTried += tried[t];
+	}
+
+	if (Params.Verbose >= 1)
+	{
+		cout << "Created " << numAdded << " local transformations out of "
+			<< numTried << " attempts on "
+			<< Params.NumThreads << " threads" << endl;
+	}
+}
+
+bool MCTS::ReweightBeliefs(int action, int observation, BELIEF_STATE& beliefs)
+{
+	const BELIEF_STATE& prior = Root->GetBeliefs();
+	int numSamples = prior.GetNumSamples();
+	int numParticles = prior.GetNumParticles();
+	std::vector<STATE*> states(numSamples);
+	std::vector<double> weights(numSamples);
+	std::vector<double> reward;
+	double totalWeight = 0;
+
+	for (int i = 0; i < numSamples; i++)
+	{
+		int stepObs;
+		states[i] = Simulator.Copy(*prior.GetSample(i));
+		Simulator.Step(*states[i], action, stepObs, reward);
+		double weight = Simulator.ObservationLikelihood(*states[i], action, stepObs, observation);
+		if (weight < 0) // no observation model, fall back to exact matching
+			weight = stepObs == observation;
+		weights[i] = weight * prior.GetCount(i);
+		totalWeight += weights[i];
+	}
+
+	// Systematic resampling, keeping the size of the particle set
+	int added = 0;
+	if (totalWeight > 0)
+	{
+		double step = totalWeight / numParticles;
+		double u = RandomDouble(0, step);
+		double cumulative = weights[0];
+		int index = 0;
+		for (int n = 0; n < numParticles; n++, u += step)
+		{
+			while (u > cumulative && index < numSamples - 1)
+				cumulative += weights[++index];
+			beliefs.AddSample(Simulator.Copy(*states[index]));
+			added++;
+		}
+	}
+
+	for (int i = 0; i < numSamples; i++)
+		Simulator.FreeState(states[i]);
+
+	if (Params.Verbose >= 1)
+	{
+		cout << "Resampled " << added << " particles with total weight "
+			<< totalWeight << endl;
+	}
+	return added > 0;
+}
+
 STATE* MCTS::CreateTransform() const
 {
 	int stepObs;
 	std::vector<double> stepReward;
 
-	STATE* state = Root->Beliefs().CreateSample(Simulator);
+	STATE* state = Root->GetBeliefs().CreateSample(Simulator);
 	Simulator.Step(*state, History.Back().Action, stepObs, stepReward);
 	if (Simulator.LocalMove(*state, History, stepObs, Status))
 		return state;
@@ -486,6 +1431,97 @@ STATE* MCTS::CreateTransform() const
 
 double MCTS::UCB[UCB_N][UCB_n];
 bool MCTS::InitialisedFastUCB = true;
+std::unique_ptr<MAST> MCTS::Mast;
+std::unique_ptr<DECISION_CACHE> MCTS::Decisions;
+std::unique_ptr<OPENING_BOOK> MCTS::Book;
+
+bool MCTS::WarmStart(const std::vector<double>& cumulativeReward)
+{
+	// Merge the cached visits into the root, and skip the search
+	// altogether once enough of them have been gathered
+	const DECISION_CACHE::ENTRY* entry = Decisions->Find(History, cumulativeReward);
+	if (entry)
+	{
+		std::vector<double> mean(2);
+		for (int a = 0; a < Simulator.GetNumActions(); a++)
+		{
+			int count = entry->Counts[a];
+			if (count == 0)
+				continue;
+			for (int i = 0; i < 2; i++)
+				mean[i] = entry->Totals[a * 2 + i] / count;
+			Root->Child(a).Value.Add(mean, count);
+			Root->Value.Add(mean, count);
+		}
+		if (entry->TotalCount >= Params.DecisionCacheSkip * Params.NumSimulations)
+		{
+			if (Params.Verbose >= 1)
+				cout << "Reusing " << entry->TotalCount << " cached root visits" << endl;
+			return true;
+		}
+	}
+
+	DecisionCounts.resize(Simulator.GetNumActions());
+	DecisionTotals.resize(Simulator.GetNumActions() * 2);
+	for (int a = 0; a < Simulator.GetNumActions(); a++)
+	{
+		const VALUE<int>& value = Root->Child(a).Value;
+		DecisionCounts[a] = value.GetCount();
+		std::vector<double> mean = value.GetValue();
+		for (int i = 0; i < 2; i++)
+			DecisionTotals[a * 2 + i] = value.GetCount() > 0 ? mean[i] * value.GetCount() : 0;
+	}
+	return false;
+}
+
+void MCTS::GatherParticles(int action, int count)
+{
+	// A skipped search leaves no particles below the root, so step the chosen
+	// action from the root particles instead: the next Update then matches a
+	// node holding as many particles as a search would have left, for the
+	// cost of the steps alone, without tree descents or rollouts
+	if (Params.OpenLoop || Root->GetBeliefs().GetAnalytic())
+		return;
+	int historyDepth = History.Size();
+	QNODE& qnode = Root->Child(action);
+	vector<double> reward(2, 0.0);
+	for (int n = 0; n < count; n++)
+	{
+		STATE* state = Root->GetBeliefs().CreateSample(Simulator);
+		int observation, steps;
+		if (Simulator.MacroStep(*state, action, observation, reward, steps))
+		{
+			Simulator.FreeState(state);
+			continue;
+		}
+		VNODE*& vnode = qnode.Child(observation);
+		if (!vnode)
+		{
+			History.Add(action, observation);
+			vnode = ExpandNode(state);
+			History.Truncate(historyDepth);
+		}
+		vnode->Beliefs().AddSample(state);
+	}
+}
+
+void MCTS::StoreDecision(const std::vector<double>& cumulativeReward)
+{
+	// Only the visits of this search are added, not the warm start
+	DECISION_CACHE::ENTRY& entry = Decisions->Add(History, cumulativeReward);
+	for (int a = 0; a < Simulator.GetNumActions(); a++)
+	{
+		const VALUE<int>& value = Root->Child(a).Value;
+		int count = value.GetCount() - DecisionCounts[a];
+		if (count <= 0)
+			continue;
+		std::vector<double> mean = value.GetValue();
+		entry.Counts[a] += count;
+		entry.TotalCount += count;
+		for (int i = 0; i < 2; i++)
+			entry.Totals[a * 2 + i] += mean[i] * value.GetCount() - DecisionTotals[a * 2 + i];
+	}
+}
 
 void MCTS::InitFastUCB(double exploration)
 {
@@ -524,7 +1560,13 @@ void MCTS::DisplayStatistics(ostream& ostr) const
 	{
 		StatTreeDepth.Print("Tree depth", ostr);
 		StatRolloutDepth.Print("Rollout depth", ostr);
+		if (Params.AdaptiveBudget)
+			StatSimulations.Print("Simulations", ostr);
 		StatTotalReward.Print("Total reward", ostr);
+		ostr << "Nodes allocated: " << VNODE::GetNumAllocated()
+			<< " (" << VNODE::GetNumAllocated() * sizeof(VNODE) / 1024 << " KB), "
+			<< "belief tables: " << VNODE::GetNumBeliefs()
+			<< " (" << VNODE::GetNumBeliefs() * sizeof(BELIEF_STATE) / 1024 << " KB)" << endl;
 	}
 
 	if (Params.Verbose >= 2)
@@ -551,111 +1593,495 @@ void MCTS::DisplayPolicy(int depth, ostream& ostr) const
 }
 
 //-----------------------------------------------------------------------------
-/*
 void MCTS::UnitTest()
 {
-	UnitTestGreedy();
-	UnitTestUCB();
+	InitFastUCB(1);
 	UnitTestRollout();
 	for (int depth = 1; depth <= 3; ++depth)
 		UnitTestSearch(depth);
+	UnitTestTreePolicies();
+	UnitTestAdaptiveBudget();
+	UnitTestOpenLoop();
+	UnitTestMast();
+	UnitTestRolloutCache();
+	UnitTestRolloutSearch();
+	UnitTestEnsemble();
+	UnitTestTransforms();
+	UnitTestPonder();
+	UnitTestBeliefs();
+	UnitTestDecisionCache();
+	UnitTestProfile();
+	UnitTestBook();
 }
 
-void MCTS::UnitTestGreedy()
+void MCTS::UnitTestBeliefs()
 {
-	TEST_SIMULATOR testSimulator(5, 5, 0);
+	TEST_SIMULATOR testSimulator(2, 2, 2, 3);
 	PARAMS params;
+	params.NumStartStates = 10;
 	MCTS mcts(testSimulator, params);
-	int numAct = testSimulator.GetNumActions();
-	int numObs = testSimulator.GetNumObservations();
-
-	VNODE* vnode = mcts.ExpandNode(testSimulator.CreateStartState());
-	vnode->Value.Set(1, 0);
-	vnode->Child(0).Value.Set(0, 1);
-	for (int action = 1; action < numAct; action++)
-		vnode->Child(action).Value.Set(0, 0);
-	assert(mcts.GreedyUCB(vnode, false) == 0);
-}
 
-void MCTS::UnitTestUCB()
-{
-	TEST_SIMULATOR testSimulator(5, 5, 0);
-	PARAMS params;
-	MCTS mcts(testSimulator, params);
-	int numAct = testSimulator.GetNumActions();
-	int numObs = testSimulator.GetNumObservations();
-
-	// With equal value, action with lowest count is selected
-	VNODE* vnode1 = mcts.ExpandNode(testSimulator.CreateStartState());
-	vnode1->Value.Set(1, 0);
-	for (int action = 0; action < numAct; action++)
-		if (action == 3)
-			vnode1->Child(action).Value.Set(99, 0);
-		else
-			vnode1->Child(action).Value.Set(100 + action, 0);
-	assert(mcts.GreedyUCB(vnode1, true) == 3);
-
-	// With high counts, action with highest value is selected
-	VNODE* vnode2 = mcts.ExpandNode(testSimulator.CreateStartState());
-	vnode2->Value.Set(1, 0);
-	for (int action = 0; action < numAct; action++)
-		if (action == 3)
-			vnode2->Child(action).Value.Set(99 + numObs, 1);
-		else
-			vnode2->Child(action).Value.Set(100 + numAct - action, 0);
-	assert(mcts.GreedyUCB(vnode2, true) == 3);
-
-	// Action with low value and low count beats actions with high counts
-	VNODE* vnode3 = mcts.ExpandNode(testSimulator.CreateStartState());
-	vnode3->Value.Set(1, 0);
-	for (int action = 0; action < numAct; action++)
-		if (action == 3)
-			vnode3->Child(action).Value.Set(1, 1);
-		else
-			vnode3->Child(action).Value.Set(100 + action, 1);
-	assert(mcts.GreedyUCB(vnode3, true) == 3);
-
-	// Actions with zero count is always selected
-	VNODE* vnode4 = mcts.ExpandNode(testSimulator.CreateStartState());
-	vnode4->Value.Set(1, 0);
-	for (int action = 0; action < numAct; action++)
-		if (action == 3)
-			vnode4->Child(action).Value.Set(0, 0);
-		else
-			vnode4->Child(action).Value.Set(1, 1);
-	assert(mcts.GreedyUCB(vnode4, true) == 3);
+	// Reading an empty node's beliefs does not allocate a slot
+	int numBeliefs = VNODE::GetNumBeliefs();
+	VNODE* vnode = VNODE::Create();
+	assert(vnode->GetBeliefs().Empty());
+	assert(VNODE::GetNumBeliefs() == numBeliefs);
+	vnode->Beliefs().AddSample(testSimulator.CreateStartState());
+	assert(VNODE::GetNumBeliefs() == numBeliefs + 1);
+	VNODE::Free(vnode, testSimulator);
+	assert(VNODE::GetNumBeliefs() == numBeliefs);
 }
 
 void MCTS::UnitTestRollout()
 {
-	TEST_SIMULATOR testSimulator(2, 2, 0);
+	// A random rollout earns 1 once it plays action 0 within the test
+	// simulator's depth, and stops there
+	TEST_SIMULATOR testSimulator(3, 2, 2, 2);
 	PARAMS params;
-	params.NumSimulations = 1000;
 	params.MaxDepth = 10;
+	params.NumSimulations = 10000;
+	params.NumStartStates = 10;
 	MCTS mcts(testSimulator, params);
 	double totalReward = 0;
-	for (int n = 0; n < mcts.Params.NumSimulations; ++n)
+	for (int n = 0; n < params.NumSimulations; ++n)
 	{
 		STATE* state = testSimulator.CreateStartState();
 		mcts.TreeDepth = 0;
-		totalReward += mcts.Rollout(*state);
+		totalReward += mcts.Rollout(*state)[0];
+		testSimulator.FreeState(state);
+		mcts.History.Truncate(0);
 	}
-	double rootValue = totalReward / mcts.Params.NumSimulations;
-	double meanValue = testSimulator.MeanValue();
-	assert(fabs(meanValue - rootValue) < 0.1);
+	double rootValue = totalReward / params.NumSimulations;
+	assert(fabs(rootValue - 5.0 / 9.0) < 0.03);
 }
 
 void MCTS::UnitTestSearch(int depth)
 {
-	TEST_SIMULATOR testSimulator(3, 2, depth);
+	// Action 0 pays 1 up to the test simulator's depth, and a simulation ends
+	// at its first reward, so action 0 is worth exactly 1 from the root.
+	// Nodes expand on their first visit, so no rollout follows a reward
+	TEST_SIMULATOR testSimulator(3, 2, 2, depth);
 	PARAMS params;
 	params.MaxDepth = depth + 1;
+	params.ExpandCount = 0;
 	params.NumSimulations = pow(10, depth + 1);
+	params.NumStartStates = 10;
 	MCTS mcts(testSimulator, params);
-	mcts.UCTSearch();
-	double rootValue = mcts.Root->Value.GetValue();
-	double optimalValue = testSimulator.OptimalValue();
-	assert(fabs(optimalValue - rootValue) < 0.1);
+	vector<double> cumulative(2, 0.0);
+	mcts.UCTSearch(cumulative);
+	assert(mcts.GreedyUCB(mcts.Root, false, cumulative) == 0);
+	assert(mcts.Root->Child(0).Value.GetValue() == vector<double>(2, 1.0));
+	assert(mcts.Root->Value.GetCount() == params.NumSimulations);
+
+	// The descent leaves the search where it started
+	assert(mcts.History.Size() == 0 && mcts.TreeDepth == 0);
+}
+
+void MCTS::UnitTestTreePolicies()
+{
+	// Every tree policy finds and mostly visits the paying action
+	const char* policies[] = { "ucb1", "ucbv", "pareto" };
+	for (const char* policy : policies)
+	{
+		TEST_SIMULATOR testSimulator(3, 2, 2, 1);
+		PARAMS params;
+		params.MaxDepth = 2;
+		params.NumSimulations = 1000;
+		params.NumStartStates = 10;
+		params.TreePolicy = policy;
+		MCTS mcts(testSimulator, params);
+		vector<double> cumulative(2, 0.0);
+		mcts.UCTSearch(cumulative);
+		assert(mcts.GreedyUCB(mcts.Root, false, cumulative) == 0);
+		for (int action = 1; action < 3; action++)
+			assert(mcts.Root->Child(0).Value.GetCount() > mcts.Root->Child(action).Value.GetCount());
+	}
+
+	// The UCB-V width stays finite for the illegal-action sentinel
+	TEST_SIMULATOR testSimulator(3, 2, 2, 1);
+	assert(testSimulator.GetRewardRange() == 1.0);
+	PARAMS params;
+	params.NumStartStates = 10;
+	MCTS mcts(testSimulator, params);
+	QNODE& illegal = mcts.Root->Child(0);
+	illegal.Value.Set(LargeInteger, -Infinity);
+	assert(illegal.Value.GetVariance() == 0);
+	assert(std::isfinite(UCBV_BONUS::Apply(mcts, 10, log(11.0), illegal)));
+}
+
+void MCTS::UnitTestAdaptiveBudget()
+{
+	// A clear-cut root decision ends the search early and banks the rest
+	TEST_SIMULATOR testSimulator(3, 2, 2, 1);
+	PARAMS params;
+	params.MaxDepth = 2;
+	params.NumSimulations = 1000;
+	params.NumStartStates = 10;
+	params.AdaptiveBudget = true;
+	params.BudgetConcentration = 0.6;
+	MCTS mcts(testSimulator, params);
+	vector<double> cumulative(2, 0.0);
+	mcts.UCTSearch(cumulative);
+	int used = mcts.Root->Value.GetCount();
+	assert(used >= params.NumSimulations / 4 && used < params.NumSimulations);
+	assert(mcts.BudgetBank == params.NumSimulations - used);
+	assert(mcts.LastConcentration >= params.BudgetConcentration);
+	assert(mcts.GreedyUCB(mcts.Root, false, cumulative) == 0);
+
+	// The bank can only raise a budget above NumSimulations by what it holds
+	assert(mcts.StepBudget() <= params.NumSimulations + mcts.BudgetBank);
+}
+
+void MCTS::UnitTestOpenLoop()
+{
+	// Open-loop nodes branch on actions only, with a single child slot, and
+	// hold no particles; the real observation is folded in by resampling
+	// the root particles
+	TEST_SIMULATOR testSimulator(3, 2, 2, 3);
+	PARAMS params;
+	params.MaxDepth = 4;
+	params.NumSimulations = 500;
+	params.NumStartStates = 100;
+	params.OpenLoop = true;
+	MCTS mcts(testSimulator, params);
+	assert(QNODE::NumChildren == 1);
+	vector<double> cumulative(2, 0.0);
+	int action = mcts.SelectAction(cumulative);
+	for (int a = 0; a < 3; a++)
+	{
+		const QNODE& qnode = mcts.Root->Child(a);
+		assert(!qnode.Child(0) || qnode.Child(0)->GetBeliefs().Empty());
+	}
+	vector<double> reward(2, 0.0);
+	assert(mcts.Update(action, 1, reward));
+	assert(mcts.BeliefState().GetNumParticles() == params.NumStartStates);
+}
+
+void MCTS::UnitTestMast()
+{
+	TEST_SIMULATOR testSimulator(3, 2, 2, 3);
+	PARAMS params;
+	params.NumStartStates = 10;
+	params.Mast = true;
+	params.MastTemperature = 0.1;
+	Mast.reset();
+	MCTS mcts(testSimulator, params);
+	STATE* state = testSimulator.CreateStartState();
+
+	// Untried actions count as the best tried one
+	Mast->Add(1, vector<double>{ 0, 0 });
+	int picks[3] = { 0, 0, 0 };
+	for (int n = 0; n < 3000; n++)
+		picks[mcts.SelectMast(*state, mcts.History, mcts.Status)]++;
+	for (int action = 0; action < 3; action++)
+		assert(picks[action] > 800);
+
+	// A cold temperature all but always picks the best mean return
+	Mast->Add(0, vector<double>{ 1, 1 });
+	Mast->Add(2, vector<double>{ 0, 0 });
+	picks[0] = 0;
+	for (int n = 0; n < 1000; n++)
+		picks[0] += mcts.SelectMast(*state, mcts.History, mcts.Status) == 0;
+	assert(picks[0] > 990);
+
+	// The statistics outlive the search that gathered them
+	MAST* mast = Mast.get();
+	MCTS next(testSimulator, params);
+	assert(Mast.get() == mast);
+	testSimulator.FreeState(state);
+	Mast.reset();
+}
+
+void MCTS::UnitTestRolloutCache()
+{
+	// Concurrent adds to shared keys lose nothing
+	ROLLOUT_CACHE cache(64, 2);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; t++)
+		threads.push_back(std::thread([&cache]()
+		{
+			for (int n = 0; n < 100; n++)
+				for (std::uint64_t key = 0; key < 32; key++)
+					cache.Add(key, vector<double>{ (double) key, 2.0 * key });
+		}));
+	for (int t = 0; t < 4; t++)
+		threads[t].join();
+	vector<double> value;
+	for (std::uint64_t key = 0; key < 32; key++)
+	{
+		assert(cache.Lookup(key, 400, value));
+		assert(value == (vector<double>{ (double) key, 2.0 * key }));
+		assert(!cache.Lookup(key, 401, value));
+	}
+	assert(!cache.Lookup(32, 0, value));
+
+	// A full table drops new keys rather than evicting old ones
+	for (std::uint64_t key = 32; key < 1000; key++)
+		cache.Add(key, vector<double>{ 0, 0 });
+	for (std::uint64_t key = 0; key < 32; key++)
+		assert(cache.Lookup(key, 400, value));
+}
+
+void MCTS::UnitTestRolloutSearch()
+{
+	// Threaded flat rollouts spend exactly the budget, and halving keeps
+	// the paying action to the end
+	TEST_SIMULATOR testSimulator(3, 2, 2, 3);
+	for (int halving = 0; halving < 2; halving++)
+	{
+		PARAMS params;
+		params.MaxDepth = 4;
+		params.NumSimulations = 301;
+		params.NumStartStates = 10;
+		params.DisableTree = true;
+		params.NumThreads = 4;
+		params.SuccessiveHalving = halving;
+		MCTS mcts(testSimulator, params);
+		vector<double> cumulative(2, 0.0);
+		assert(mcts.SelectAction(cumulative) == 0);
+		int total = 0;
+		for (int action = 0; action < 3; action++)
+			total += mcts.Root->Child(action).Value.GetCount();
+		assert(total == params.NumSimulations);
+		assert(mcts.History.Size() == 0);
+	}
+
+	// Banked simulations raise the flat rollout budget as they do the tree's
+	PARAMS params;
+	params.MaxDepth = 4;
+	params.NumSimulations = 300;
+	params.NumStartStates = 10;
+	params.DisableTree = true;
+	params.AdaptiveBudget = true;
+	MCTS mcts(testSimulator, params);
+	mcts.BudgetBank = 100;
+	vector<double> cumulative(2, 0.0);
+	mcts.SelectAction(cumulative);
+	int total = 0;
+	for (int action = 0; action < 3; action++)
+		total += mcts.Root->Child(action).Value.GetCount();
+	assert(total == params.NumSimulations + 100);
+	assert(mcts.BudgetBank == 0);
+}
+
+void MCTS::UnitTestEnsemble()
+{
+	// The pooled root counts exactly the members' simulations, and both
+	// modes settle on the paying action
+	TEST_SIMULATOR testSimulator(3, 2, 2, 3);
+	const char* modes[2] = { "pooled", "vote" };
+	for (int i = 0; i < 2; i++)
+	{
+		PARAMS params;
+		params.MaxDepth = 4;
+		params.NumSimulations = 400;
+		params.NumStartStates = 40;
+		params.EnsembleMode = modes[i];
+		params.EnsembleSize = 4;
+		MCTS mcts(testSimulator, params);
+		vector<double> cumulative(2, 0.0);
+		assert(mcts.SelectAction(cumulative) == 0);
+		assert(mcts.Root->Value.GetCount() == params.NumSimulations);
+		assert(mcts.BeliefState().GetNumParticles() == params.NumStartStates);
+	}
+}
+
+void MCTS::UnitTestTransforms()
+{
+	// Workers stop at exactly NumTransforms accepted, or at MaxAttempts
+	TEST_SIMULATOR testSimulator(3, 2, 2, 4);
+	PARAMS params;
+	params.NumStartStates = 10;
+	params.NumThreads = 4;
+	params.NumTransforms = 100;
+	MCTS mcts(testSimulator, params);
+	mcts.History.Add(0, 0);
+	int maxAttempts[2] = { 1000, 30 };
+	for (int i = 0; i < 2; i++)
+	{
+		mcts.Params.MaxAttempts = maxAttempts[i];
+		BELIEF_STATE beliefs;
+		mcts.AddTransforms(mcts.Root, beliefs);
+		assert(beliefs.GetNumSamples() == min(params.NumTransforms, maxAttempts[i]));
+		beliefs.Free(testSimulator);
+	}
+}
+
+void MCTS::UnitTestPonder()
+{
+	TEST_SIMULATOR testSimulator(3, 2, 2, 4);
+	PARAMS params;
+	params.MaxDepth = 5;
+	params.NumSimulations = 200;
+	params.NumStartStates = 50;
+	params.Ponder = true;
+	params.SaveBook = "ponder.book";
+	MCTS mcts(testSimulator, params);
+	vector<double> cumulative(2, 0.0);
+	int action = mcts.SelectAction(cumulative);
+
+	// Saving a book stops the pondering before the tree is written
+	assert(mcts.PonderThread.joinable());
+	assert(mcts.SaveBook());
+	assert(!mcts.PonderThread.joinable());
+	remove(params.SaveBook.c_str());
+
+	// Every pondered simulation lands below the chosen action, leaving the
+	// root statistics alone
+	int searched = mcts.Root->Child(action).Value.GetCount();
+	int rootVisits = mcts.Root->Value.GetCount();
+	auto particlesBelow = [&]()
+	{
+		int particles = 0;
+		for (int o = 0; o < testSimulator.GetNumObservations(); o++)
+			if (mcts.Root->Child(action).Child(o))
+				particles += mcts.Root->Child(action).Child(o)->GetBeliefs().GetNumSamples();
+		return particles;
+	};
+	int particles = particlesBelow();
+	mcts.StartPondering(action, cumulative);
+	std::this_thread::sleep_for(std::chrono::milliseconds(500));
+	mcts.StopPondering();
+	assert(mcts.PonderSimulations == params.NumSimulations);
+	assert(mcts.Root->Child(action).Value.GetCount() == searched);
+	assert(mcts.Root->Value.GetCount() == rootVisits);
+	assert(particlesBelow() == particles + params.NumSimulations);
+	assert(mcts.Ponderer->History == mcts.History);
+
+	// The pondered subtree becomes the new root, particles included
+	int observation = 0;
+	while (!mcts.Root->Child(action).Child(observation))
+		observation++;
+	int visits = mcts.Root->Child(action).Child(observation)->Value.GetCount();
+	vector<double> reward(2, 0.0);
+	assert(mcts.Update(action, observation, reward));
+	assert(mcts.Root->Value.GetCount() == visits);
+	assert(!mcts.Root->GetBeliefs().Empty());
+}
+
+void MCTS::UnitTestDecisionCache()
+{
+	TEST_SIMULATOR testSimulator(3, 2, 2, 1);
+	PARAMS params;
+	params.MaxDepth = 2;
+	params.NumSimulations = 100;
+	params.NumStartStates = 10;
+	params.DecisionCache = true;
+	params.DecisionCacheSkip = 2;
+	Decisions.reset();
+	vector<double> cumulative(2, 0.0);
+
+	// The first episode stores its search, the second merges it and adds its own
+	for (int episode = 1; episode <= 2; episode++)
+	{
+		MCTS mcts(testSimulator, params);
+		assert(mcts.SelectAction(cumulative) == 0);
+		const DECISION_CACHE::ENTRY* entry = Decisions->Find(mcts.History, cumulative);
+		assert(entry && entry->TotalCount == episode * params.NumSimulations);
+		int visits = 0;
+		for (int a = 0; a < 3; a++)
+			visits += mcts.Root->Child(a).Value.GetCount();
+		assert(visits >= episode * params.NumSimulations);
+	}
+
+	// Enough cached visits skip the search and still pick the paying action.
+	// The merged visits count at the root too, and particles are gathered
+	// below the chosen action for the next update
+	MCTS mcts(testSimulator, params);
+	int rootCount = mcts.Root->Value.GetCount();
+	assert(mcts.SelectAction(cumulative) == 0);
+	assert(mcts.Root->Value.GetCount() == rootCount + 2 * params.NumSimulations);
+	int particles = 0;
+	for (int o = 0; o < testSimulator.GetNumObservations(); o++)
+		if (mcts.Root->Child(0).Child(o))
+			particles += mcts.Root->Child(0).Child(o)->GetBeliefs().GetNumSamples();
+	assert(particles == params.NumSimulations);
+	assert(Decisions->Find(mcts.History, cumulative)->TotalCount == 2 * params.NumSimulations);
+	assert(Decisions->GetNumEntries() == 1);
+	Decisions.reset();
+}
+
+void MCTS::UnitTestProfile()
+{
+	// A profile build counts one tree phase per simulation and one search,
+	// otherwise the totals stay empty; taking them clears them either way
+	TEST_SIMULATOR testSimulator(3, 2, 2, 2);
+	PARAMS params;
+	params.MaxDepth = 3;
+	params.NumSimulations = 100;
+	params.NumStartStates = 10;
+	MCTS mcts(testSimulator, params);
+	PROFILE::Take();
+	vector<double> cumulative(2, 0.0);
+	mcts.UCTSearch(cumulative);
+	PROFILE::TOTALS totals = PROFILE::Take();
+	assert(totals.Count[PROFILE::TREE] == (PROFILE::Enabled ? params.NumSimulations : 0));
+	assert(totals.Count[PROFILE::SEARCH] == (PROFILE::Enabled ? 1 : 0));
+	assert(totals.Count[PROFILE::STEP] >= totals.Count[PROFILE::TREE]);
+	assert(PROFILE::Enabled || totals.GetTotalSeconds() == 0);
+	totals = PROFILE::Take();
+	for (int p = 0; p < PROFILE::NUM_PHASES; p++)
+		assert(totals.Count[p] == 0);
+}
+
+void MCTS::UnitTestBook()
+{
+	TEST_SIMULATOR testSimulator(3, 4, 2, 3);
+	PARAMS params;
+	params.NumStartStates = 0;
+	MCTS mcts(testSimulator, params);
+
+	// Root with an illegal action and one searched child two levels down
+	VNODE* root = VNODE::Create();
+	root->Value.Set(0, 0);
+	for (int action = 0; action < 3; action++)
+		root->Child(action).Value.Set(0, 0);
+	root->Child(0).Value.Add(std::vector<double>{ 1, 2 }, 5);
+	root->Child(1).Value.Add(std::vector<double>{ 3, 4 }, 7);
+	root->Child(2).Value.Set(+LargeInteger, -Infinity);
+	VNODE* child = VNODE::Create();
+	child->Value.Set(0, 0);
+	for (int action = 0; action < 3; action++)
+		child->Child(action).Value.Set(0, 0);
+	child->Child(2).Value.Add(std::vector<double>{ 5, 6 }, 3);
+	root->Child(1).Child(3) = child;
+
+	ostringstream ostr;
+	OPENING_BOOK::Write(ostr, root, 4, false);
+	string data = ostr.str();
+	std::unique_ptr<OPENING_BOOK> book(OPENING_BOOK::Attach(data.data(), data.size(), 3, 4, false));
+	assert(book && book->GetNumNodes() == 2);
+	assert(!OPENING_BOOK::Attach(data.data(), data.size(), 3, 5, false));
+
+	HISTORY history;
+	assert(book->Find(history) == 0);
+	history.Add(1, 3);
+	assert(book->Find(history) == 1);
+	history.Pop();
+	history.Add(1, 2);
+	assert(book->Find(history) == -1);
+
+	// Building the stored tree gives back the searched statistics
+	VNODE* built = book->Build(0);
+	assert(built->Child(0).Value.GetCount() == 5);
+	assert(built->Child(1).Value.GetValue() == (std::vector<double>{ 3, 4 }));
+	assert(built->Child(2).Value.GetCount() == LargeInteger);
+	assert(!built->Child(1).Child(0) && built->Child(1).Child(3));
+	assert(built->Child(1).Child(3)->Child(2).Value.GetCount() == 3);
+	assert(built->Child(1).Child(3)->Child(2).Value.GetValue() == (std::vector<double>{ 5, 6 }));
+
+	// Indices that leave the arrays are rejected
+	string corrupt = data;
+	OPENING_BOOK::ACTION_RECORD* actions = (OPENING_BOOK::ACTION_RECORD*) &corrupt[sizeof(OPENING_BOOK::HEADER)];
+	actions[1].NumChildren = 2;
+	assert(!OPENING_BOOK::Attach(corrupt.data(), corrupt.size(), 3, 4, false));
+	corrupt = data;
+	OPENING_BOOK::CHILD_RECORD* children = (OPENING_BOOK::CHILD_RECORD*) &corrupt[sizeof(OPENING_BOOK::HEADER)
+		+ 6 * sizeof(OPENING_BOOK::ACTION_RECORD)];
+	children[0].Node = 0;
+	assert(!OPENING_BOOK::Attach(corrupt.data(), corrupt.size(), 3, 4, false));
+
+	VNODE::Free(built, testSimulator);
+	VNODE::Free(root, testSimulator);
 }
-*/
 //-----------------------------------------------------------------------------
@@ -5,7 +5,14 @@
 #include "node.h"
 #include "statistic.h"
 #include "vectorstatistic.h"
+#include "rolloutcache.h"
+#include "mast.h"
+#include "decisioncache.h"
+#include "book.h"
 #include <numeric>
+#include <thread>
+#include <atomic>
+#include <memory>
 
 class MCTS
 {
@@ -33,7 +40,30 @@ public:
 		double RaveConstant;
 		bool DisableTree;
 		std::string Strategy;
+		std::string TreePolicy; // ucb1, ucbv or pareto
+		std::string RootAllocator; // ucb, halving or toptwo
 		bool ConsiderPast; // consider past cumulated reward or not
+		bool Ponder; // keep searching below the chosen action between real steps
+		int NumThreads;
+		bool WeightedBelief; // importance-weighted belief update instead of rejection
+		bool CompactBelief; // merge duplicate root particles into counts
+		bool AnalyticBelief; // closed-form belief when the simulator has one
+		std::string EnsembleMode; // none, vote or pooled
+		bool SuccessiveHalving; // halve the root actions between rollout rounds
+		int LeafDepth; // rollout steps before the simulator leaf value is used, -1 to disable
+		int RolloutCacheSize; // slots in the rollout return cache, 0 to disable
+		int RolloutCacheCount; // rollouts recorded before the cached mean is used
+		bool Mast; // Gibbs sampling over persistent per-action returns in rollouts
+		double MastTemperature;
+		bool OpenLoop; // nodes keyed by action sequence only
+		bool AdaptiveBudget; // vary simulations per step around NumSimulations
+		double BudgetConcentration; // root visit share that ends an adaptive search early
+		bool UndoSimulation; // simulate on the particles and undo, if the simulator can
+		bool DecisionCache; // share root statistics between episodes with the same history
+		double DecisionCacheSkip; // cached visits, in searches, after which the search is skipped
+		std::string BookFile; // opening book merged into early roots, empty for none
+		std::string SaveBook; // file the first searched tree of an episode is written to
+		int BookDepth; // tree levels written to the opening book
 	};
 
 	MCTS(const SIMULATOR& simulator, const PARAMS& params);
@@ -42,12 +72,26 @@ public:
 	virtual int SelectAction(const std::vector<double>& cumulativeReward);
 	bool Update(int action, int observation, std::vector<double>& reward);
 
+	// Resume from a checkpoint: real history, root beliefs and optionally
+	// the searched tree, which are all taken over
+	void Restore(const HISTORY& history, BELIEF_STATE& beliefs, VNODE* root);
+
 	void UCTSearch(const std::vector<double>& cumulativeReward);
 	void RolloutSearch();
+	int EnsembleSearch(const std::vector<double>& cumulativeReward);
+
+	// Background search under Root->Child(action) while the real environment steps
+	void StartPondering(int action, const std::vector<double>& cumulativeReward);
+	void StopPondering();
 
 	std::vector<double> Rollout(STATE& state);
+	std::vector<double> Rollout(STATE& state, HISTORY& history,
+		SIMULATOR::STATUS& status, int treeDepth, STATISTIC& rolloutDepth) const;
 
-	const BELIEF_STATE& BeliefState() const { return Root->Beliefs(); }
+	const BELIEF_STATE& BeliefState() const { return Root->GetBeliefs(); }
+	// Write the first BookDepth levels of the current tree to SaveBook,
+	// stopping any pondering on it first
+	bool SaveBook();
 	const HISTORY& GetHistory() const { return History; }
 	const SIMULATOR::STATUS& GetStatus() const { return Status; }
 	void ClearStatistics();
@@ -55,18 +99,23 @@ public:
 	void DisplayValue(int depth, std::ostream& ostr) const;
 	void DisplayPolicy(int depth, std::ostream& ostr) const;
 
-	// static void UnitTest();
+	static void UnitTest();
 	static void InitFastUCB(double exploration);
 
-	int GreedyUCB(VNODE* vnode, bool ucb, const std::vector<double> cumulativeReward) const;
+	int GreedyUCB(VNODE* vnode, bool ucb, const std::vector<double> cumulativeReward) const
+	{
+		return (this->*TreeSelect)(vnode, ucb, cumulativeReward);
+	}
 	int SelectRandom() const;
-	std::vector<double> SimulateV(STATE& state, VNODE* vnode, std::vector<double> cumulativeReward, bool foundOneRock);
-	std::vector<double> SimulateQ(STATE& state, QNODE& qnode, int action, std::vector<double> cumulativeReward);
+	std::vector<double> Simulate(STATE& state, VNODE* vnode, std::vector<double> cumulativeReward, int rootAction = -1);
 	void AddRave(VNODE* vnode, double totalReward);
 	VNODE* ExpandNode(const STATE* state);
 	void AddSample(VNODE* node, const STATE& state);
 	void AddTransforms(VNODE* root, BELIEF_STATE& beliefs);
+	void AddTransformsParallel(BELIEF_STATE& beliefs);
+	void CreateStartStates(std::vector<STATE*>& states) const;
 	STATE* CreateTransform() const;
+	bool ReweightBeliefs(int action, int observation, BELIEF_STATE& beliefs);
 	void Resample(BELIEF_STATE& beliefs);
 
 	// Fast lookup table for UCB
@@ -83,12 +132,97 @@ public:
 	SIMULATOR::STATUS Status;
 	STATISTIC StatTreeDepth;
 	STATISTIC StatRolloutDepth;
+	STATISTIC StatSimulations;
 	VECTORSTATISTIC StatTotalReward = VECTORSTATISTIC(2);
 private:
-	static void UnitTestGreedy();
-	static void UnitTestUCB();
+	// One step of the current simulation's path through the tree
+	struct PATH_ENTRY
+	{
+		VNODE* VNode;
+		QNODE* QNode;
+		int Action;
+		int Steps; // primitive steps taken by the action
+		std::vector<double> Reward;
+	};
+
+	std::vector<PATH_ENTRY> Path;
+	int PathLength;
+
+	// Open-loop trees share one child per action for all observations
+	int ChildIndex(int observation) const { return Params.OpenLoop ? 0 : observation; }
+
+	void Ponder(int action, std::vector<double> cumulativeReward, unsigned int seed);
+
+	// Searches this tree in the ponder thread with its own history, status and
+	// path, so that the caller can keep reading this search's state
+	std::unique_ptr<MCTS> Ponderer;
+	std::thread PonderThread;
+	std::atomic<bool> PonderStop;
+	int PonderSimulations;
+
+	// Shared with ensemble members and the ponderer
+	std::shared_ptr<ROLLOUT_CACHE> RolloutCache;
+
+	// Simulation steps are being recorded in the simulator's undo log
+	bool Undoing;
+
+	// Action recommended by the root allocator of the last search, or -1
+	int RootChoice;
+
+	// Adaptive budget: simulations saved on easy steps are banked and may be
+	// spent on hard ones, so an episode never exceeds NumSimulations per step
+	int BudgetBank;
+	double LastConcentration;
+	int StepBudget() const;
+	double BeliefEntropy() const;
+	double RootConcentration(const std::vector<int>& startCounts) const;
+
+	// Tree policy: a scalarisation and an exploration bonus, combined once at
+	// construction into TreeSelect. New policies add a struct and a case there
+	struct GGF_SCALARISATION;
+	struct WS_SCALARISATION;
+	struct UCB1_BONUS;
+	struct UCBV_BONUS;
+	template <class SCALARISATION, class BONUS>
+	int SelectScalarised(VNODE* vnode, bool ucb, const std::vector<double>& cumulativeReward) const;
+	template <class SCALARISATION, class BONUS>
+	int SelectPareto(VNODE* vnode, bool ucb, const std::vector<double>& cumulativeReward) const;
+	typedef int (MCTS::*SELECT_FN)(VNODE*, bool, const std::vector<double>&) const;
+	SELECT_FN TreeSelect;
+	double (*Scalarise)(std::vector<double> utility);
+
+	// Root statistics of earlier episodes, merged into the root before a
+	// search and extended with its new visits afterwards
+	static std::unique_ptr<DECISION_CACHE> Decisions;
+	std::vector<int> DecisionCounts;
+	std::vector<double> DecisionTotals;
+	bool WarmStart(const std::vector<double>& cumulativeReward);
+	void GatherParticles(int action, int count);
+	void StoreDecision(const std::vector<double>& cumulativeReward);
+
+	// Read-only prior statistics for the first levels of the tree
+	static std::unique_ptr<OPENING_BOOK> Book;
+
+	// Rollout action statistics, kept across real steps and episodes
+	static std::unique_ptr<MAST> Mast;
+	int SelectMast(const STATE& state, const HISTORY& history,
+		const SIMULATOR::STATUS& status) const;
+
 	static void UnitTestRollout();
 	static void UnitTestSearch(int depth);
+	static void UnitTestTreePolicies();
+	static void UnitTestAdaptiveBudget();
+	static void UnitTestOpenLoop();
+	static void UnitTestMast();
+	static void UnitTestRolloutCache();
+	static void UnitTestRolloutSearch();
+	static void UnitTestEnsemble();
+	static void UnitTestTransforms();
+	static void UnitTestPonder();
+	static void UnitTestBeliefs();
+	static void UnitTestDecisionCache();
+	static void UnitTestProfile();
+	static void UnitTestBook();
 };
 
 #endif // MCTS_H
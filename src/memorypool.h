@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <ostream>
+#include <atomic>
 
 class MEMORY_OBJECT
 {
@@ -46,6 +47,7 @@ public:
 
 	T* Allocate()
 	{
+		Acquire();
 		if (FreeList.empty())
 			NewChunk();
 		T* obj = FreeList.back();
@@ -53,15 +55,18 @@ public:
 		assert(!obj->IsAllocated());
 		obj->SetAllocated();
 		NumAllocated++;
+		Release();
 		return obj;
 	}
 
 	void Free(T* obj)
 	{
 		assert(obj->IsAllocated());
+		Acquire();
 		obj->ClearAllocated();
 		FreeList.push_back(obj);
 		NumAllocated--;
+		Release();
 	}
 
 	void DeleteAll()
@@ -77,6 +82,18 @@ public:
 
 private:
 
+	// Spin lock so that worker threads can share a pool
+	void Acquire()
+	{
+		while (Lock.test_and_set(std::memory_order_acquire))
+			;
+	}
+
+	void Release()
+	{
+		Lock.clear(std::memory_order_release);
+	}
+
 	struct CHUNK
 	{
 		static const int Size = 256;
@@ -97,6 +114,7 @@ private:
 	std::vector<CHUNK*> Chunks;
 	std::vector<T*> FreeList;
 	int NumAllocated;
+	std::atomic_flag Lock = ATOMIC_FLAG_INIT;
 	typedef typename std::vector<CHUNK*>::iterator ChunkIterator;
 };
 
@@ -1,6 +1,7 @@
 #include "node.h"
 #include "history.h"
 #include "utils.h"
+#include "profile.h"
 
 using namespace std;
 
@@ -64,6 +65,8 @@ void QNODE::DisplayPolicy(HISTORY& history, int maxDepth, ostream& ostr) const
 //-----------------------------------------------------------------------------
 
 MEMORY_POOL<VNODE> VNODE::VNodePool;
+MEMORY_POOL<VNODE::BELIEF_SLOT> VNODE::BeliefPool;
+const BELIEF_STATE VNODE::NoBeliefs;
 
 int VNODE::NumChildren = 0;
 
@@ -84,17 +87,29 @@ VNODE* VNODE::Create()
 
 void VNODE::Free(VNODE* vnode, const SIMULATOR& simulator)
 {
-	vnode->BeliefState.Free(simulator);
+	PROFILE_SCOPE(FREE_TREE);
+	FreeNode(vnode, simulator);
+}
+
+void VNODE::FreeNode(VNODE* vnode, const SIMULATOR& simulator)
+{
+	if (vnode->BeliefSlot)
+	{
+		vnode->BeliefSlot->Beliefs.Free(simulator);
+		BeliefPool.Free(vnode->BeliefSlot);
+		vnode->BeliefSlot = 0;
+	}
 	VNodePool.Free(vnode);
 	for (int action = 0; action < VNODE::NumChildren; action++)
 		for (int observation = 0; observation < QNODE::NumChildren; observation++)
 			if (vnode->Child(action).Child(observation))
-				Free(vnode->Child(action).Child(observation), simulator);
+				FreeNode(vnode->Child(action).Child(observation), simulator);
 }
 
 void VNODE::FreeAll()
 {
 	VNodePool.DeleteAll();
+	BeliefPool.DeleteAll();
 }
 
 void VNODE::SetChildren(int count, double value)
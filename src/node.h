@@ -4,6 +4,7 @@
 #include "beliefstate.h"
 #include "utils.h"
 #include <iostream>
+#include <cmath>
 
 class HISTORY;
 class SIMULATOR;
@@ -30,7 +31,7 @@ public:
 	{
 		Count = count;
 		// Total = value * count;
-		// SquaredTotal = value*value*count;
+		SquaredTotal = 2 * value * value * count;
 		Total.resize(2);
 		realCumulatedReward.resize(2);
 		simCumulatedReward.resize(2);
@@ -47,9 +48,9 @@ public:
 		assert(totalReward.size() == 2);
 		for (int i = 0; i < 2; i++){
 			Total[i] += totalReward[i];
+			SquaredTotal += totalReward[i] * totalReward[i];
 		}
 		// Total += totalReward;
-		// SquaredTotal += totalReward*totalReward;
 	}
 
 	void Add(const std::vector<double>& totalReward, COUNT weight)
@@ -58,6 +59,7 @@ public:
 		assert(totalReward.size() == 2);
 		for (int i = 0; i < 2; i++){
 			Total[i] += totalReward[i] * weight;
+			SquaredTotal += totalReward[i] * totalReward[i] * weight;
 		}
 		// Total += totalReward * weight;
 	}
@@ -87,6 +89,20 @@ public:
 		return SquaredTotal;
 	}
 
+	// Empirical variance of the returns, averaged over the objectives.
+	// Sentinel values (illegal actions) have none
+	double GetVariance() const
+	{
+		if (Count == 0 || !std::isfinite(SquaredTotal))
+			return 0.0;
+		double variance = SquaredTotal / Count;
+		for (int i = 0; i < 2; i++){
+			double mean = Total[i] / Count;
+			variance -= mean * mean;
+		}
+		return std::max(variance / 2, 0.0);
+	}
+
 	void AddRealCumulatedReward(const std::vector<double>& reward)
 	{
 		for (int i = 0; i < 2; i++){
@@ -167,15 +183,25 @@ public:
 	static VNODE* Create();
 	static void Free(VNODE* vnode, const SIMULATOR& simulator);
 	static void FreeAll();
+	static int GetNumAllocated() { return VNodePool.GetNumAllocated(); }
 
 	QNODE& Child(int c) { return Children[c]; }
 	const QNODE& Child(int c) const { return Children[c]; }
-	BELIEF_STATE& Beliefs() { return BeliefState; }
-	const BELIEF_STATE& Beliefs() const { return BeliefState; }
+	// Particles live in a side table and are only allocated for the nodes
+	// that receive them: the root and its grandchildren
+	BELIEF_STATE& Beliefs()
+	{
+		if (!BeliefSlot)
+			BeliefSlot = BeliefPool.Allocate();
+		return BeliefSlot->Beliefs;
+	}
+	// Read-only view that never allocates a slot
+	const BELIEF_STATE& GetBeliefs() const { return BeliefSlot ? BeliefSlot->Beliefs : NoBeliefs; }
 	void setBeliefs(BELIEF_STATE& newBelief)
 	{
-		BeliefState = newBelief;
+		Beliefs() = newBelief;
 	}
+	static int GetNumBeliefs() { return BeliefPool.GetNumAllocated(); }
 
 	void SetChildren(int count, double value);
 
@@ -184,9 +210,18 @@ public:
 
 	static int NumChildren;
 private:
+	struct BELIEF_SLOT : public MEMORY_OBJECT
+	{
+		BELIEF_STATE Beliefs;
+	};
+
+	static void FreeNode(VNODE* vnode, const SIMULATOR& simulator);
+
 	std::vector<QNODE> Children;
-	BELIEF_STATE BeliefState;
+	BELIEF_SLOT* BeliefSlot = 0;
 	static MEMORY_POOL<VNODE> VNodePool;
+	static MEMORY_POOL<BELIEF_SLOT> BeliefPool;
+	static const BELIEF_STATE NoBeliefs;
 };
 
 #endif // NODE_H
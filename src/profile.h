@@ -0,0 +1,234 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <ostream>
+#include <string>
+#include <iomanip>
+#include <chrono>
+#include <mutex>
+#include <cstdint>
+#if defined(PROFILE_SEARCH) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+
+// Counts and times the phases of the search. Built in with
+// --enable-profile (PROFILE_SEARCH), otherwise PROFILE_SCOPE expands to
+// nothing and the totals stay empty.
+//
+// Each thread accumulates ticks on its own and merges them into the shared
+// totals when it exits or takes them, so a scope costs two timestamp reads
+// and no locking. The time stamp counter is used where available, scaled by
+// steady_clock once at start-up. Nested scopes are timed exclusively: a step
+// inside a rollout counts as step time only, and the phases add up to the
+// profiled time
+class PROFILE
+{
+public:
+
+	enum PHASE
+	{
+		SEARCH,     // search set-up and root sampling
+		TREE,       // tree descent, expansion and backup, one per simulation
+		STEP,       // simulator steps
+		COPY,       // state copies and samples
+		FREE,       // state frees and undos
+		ROLLOUT,    // rollout policy
+		UPDATE,     // belief update after a real step
+		TRANSFORMS, // particle reinvigoration
+		FREE_TREE,  // freeing the old search tree
+		NUM_PHASES
+	};
+
+	struct TOTALS
+	{
+		TOTALS() { Clear(); }
+
+		void Clear()
+		{
+			for (int p = 0; p < NUM_PHASES; p++)
+			{
+				Count[p] = 0;
+				Seconds[p] = 0;
+			}
+		}
+
+		void Add(const TOTALS& totals)
+		{
+			for (int p = 0; p < NUM_PHASES; p++)
+			{
+				Count[p] += totals.Count[p];
+				Seconds[p] += totals.Seconds[p];
+			}
+		}
+
+		double GetTotalSeconds() const
+		{
+			double seconds = 0;
+			for (int p = 0; p < NUM_PHASES; p++)
+				seconds += Seconds[p];
+			return seconds;
+		}
+
+		void Print(const std::string& name, std::ostream& ostr) const
+		{
+			double total = GetTotalSeconds();
+			double search = total - Seconds[UPDATE] - Seconds[TRANSFORMS] - Seconds[FREE_TREE];
+			ostr << name << ": " << Count[TREE] << " simulations in " << total << " s, "
+				<< (search > 0 ? Count[TREE] / search : 0) << " simulations/s" << std::endl;
+			for (int p = 0; p < NUM_PHASES; p++)
+				ostr << "  " << std::left << std::setw(11) << GetName((PHASE) p) << std::right
+					<< std::setw(12) << Count[p] << std::setw(12) << Seconds[p] << " s"
+					<< std::setw(7) << std::fixed << std::setprecision(1)
+					<< (total > 0 ? 100 * Seconds[p] / total : 0) << "%"
+					<< std::defaultfloat << std::setprecision(6) << std::endl;
+		}
+
+		long long Count[NUM_PHASES];
+		double Seconds[NUM_PHASES];
+	};
+
+	static const char* GetName(PHASE phase)
+	{
+		static const char* names[NUM_PHASES] = { "search", "tree", "step", "copy",
+			"free", "rollout", "update", "transforms", "free tree" };
+		return names[phase];
+	}
+
+#ifdef PROFILE_SEARCH
+	static const bool Enabled = true;
+
+	class SCOPE
+	{
+	public:
+
+		SCOPE(PHASE phase)
+			: Phase(phase),
+			Parent(Inner()),
+			Children(0),
+			Start(Ticks())
+		{
+			Inner() = this;
+		}
+
+		~SCOPE()
+		{
+			std::uint64_t elapsed = Ticks() - Start;
+			LOCAL& local = Local();
+			local.Count[Phase]++;
+			local.Ticks[Phase] += elapsed - Children;
+			if (Parent)
+				Parent->Children += elapsed;
+			Inner() = Parent;
+		}
+
+	private:
+
+		PHASE Phase;
+		SCOPE* Parent;
+		std::uint64_t Children;
+		std::uint64_t Start;
+	};
+
+	// Totals of all threads since the last call, then cleared
+	static TOTALS Take()
+	{
+		Local().Flush();
+		std::lock_guard<std::mutex> lock(Mutex());
+		TOTALS totals = Shared();
+		Shared().Clear();
+		return totals;
+	}
+
+private:
+
+	struct LOCAL
+	{
+		LOCAL() { Clear(); }
+		~LOCAL() { Flush(); }
+
+		void Clear()
+		{
+			for (int p = 0; p < NUM_PHASES; p++)
+			{
+				Count[p] = 0;
+				Ticks[p] = 0;
+			}
+		}
+
+		void Flush()
+		{
+			static const double secondsPerTick = Calibrate();
+			std::lock_guard<std::mutex> lock(Mutex());
+			for (int p = 0; p < NUM_PHASES; p++)
+			{
+				Shared().Count[p] += Count[p];
+				Shared().Seconds[p] += Ticks[p] * secondsPerTick;
+			}
+			Clear();
+		}
+
+		long long Count[NUM_PHASES];
+		std::uint64_t Ticks[NUM_PHASES];
+	};
+
+	static std::uint64_t Ticks()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#else
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+	}
+
+	// Length of a tick, measured over a few milliseconds
+	static double Calibrate()
+	{
+		auto start = std::chrono::steady_clock::now();
+		std::uint64_t startTicks = Ticks();
+		double seconds;
+		do
+			seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		while (seconds < 0.01);
+		return seconds / (Ticks() - startTicks);
+	}
+
+	static std::mutex& Mutex()
+	{
+		static std::mutex mutex;
+		return mutex;
+	}
+
+	static TOTALS& Shared()
+	{
+		static TOTALS totals;
+		return totals;
+	}
+
+	static LOCAL& Local()
+	{
+		static thread_local LOCAL local;
+		return local;
+	}
+
+	static SCOPE*& Inner()
+	{
+		static thread_local SCOPE* inner = 0;
+		return inner;
+	}
+#else
+	static const bool Enabled = false;
+
+	static TOTALS Take() { return TOTALS(); }
+#endif
+};
+
+#ifdef PROFILE_SEARCH
+#define PROFILE_CONCAT(a, b) a##b
+#define PROFILE_NAME(line) PROFILE_CONCAT(profileScope, line)
+#define PROFILE_SCOPE(phase) PROFILE::SCOPE PROFILE_NAME(__LINE__)(PROFILE::phase)
+#else
+#define PROFILE_SCOPE(phase)
+#endif
+
+#endif // PROFILE_H
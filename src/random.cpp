@@ -1,13 +1,16 @@
 #include "random.h"
+#include "utils.h"
 
+// Drawn from the thread's RANDOM_STREAM, so bandits are safe to use in
+// concurrent searches
 int randomInt(const int range) {
 	return randomInt(0, range);
 }
 
 int randomInt(const int min, const int range) {
-	return rand() % range + min;
+	return UTILS::Random(range) + min;
 }
 
 double randomDouble() {
-	return ((double)rand()) / RAND_MAX;
+	return UTILS::RandomDouble(0, 1);
 }
@@ -1,17 +1,23 @@
 #include "rocksample.h"
+#include "mcts.h"
 #include "utils.h"
+#include <cstring>
 
 using namespace std;
 using namespace UTILS;
 
-ROCKSAMPLE::ROCKSAMPLE(int size, int rocks, int numObjectives)
+thread_local vector<ROCKSAMPLE::UNDO_ENTRY> ROCKSAMPLE::UndoLog;
+
+ROCKSAMPLE::ROCKSAMPLE(int size, int rocks, int numObjectives, bool macroActions)
 	: Grid(size, size),
 	Size(size),
 	NumRocks(rocks),
+	MacroActions(macroActions),
+	LeafDecay(0.9),
 	SmartMoveProb(0.95),
 	UncertaintyCount(0)
 {
-	NumActions = NumRocks + 5;
+	NumActions = MacroActions ? 2 * NumRocks + 6 : NumRocks + 5;
 	NumObservations = 3;
 	NumObjectives = numObjectives;
 	RewardRange = 10;
@@ -133,17 +139,86 @@ STATE* ROCKSAMPLE::Copy(const STATE& state) const
 	return newstate;
 }
 
+bool ROCKSAMPLE::CopyInto(const STATE& state, STATE& target) const
+{
+	safe_cast<ROCKSAMPLE_STATE&>(target) = safe_cast<const ROCKSAMPLE_STATE&>(state);
+	return true;
+}
+
+// Packed as position and target, then each rock entry as stored
+int ROCKSAMPLE::GetPackedSize() const
+{
+	return 4 * sizeof(int) + NumRocks * sizeof(ROCKSAMPLE_STATE::ENTRY);
+}
+
+void ROCKSAMPLE::PackState(const STATE& state, char* data) const
+{
+	const ROCKSAMPLE_STATE& rockstate = safe_cast<const ROCKSAMPLE_STATE&>(state);
+	int header[4] = { rockstate.AgentPos.X, rockstate.AgentPos.Y, rockstate.Target, 0 };
+	memcpy(data, header, sizeof(header));
+	memcpy(data + sizeof(header), rockstate.Rocks.data(),
+		NumRocks * sizeof(ROCKSAMPLE_STATE::ENTRY));
+}
+
+STATE* ROCKSAMPLE::UnpackState(const char* data) const
+{
+	ROCKSAMPLE_STATE* rockstate = MemoryPool.Allocate();
+	int header[4];
+	memcpy(header, data, sizeof(header));
+	rockstate->AgentPos = COORD(header[0], header[1]);
+	rockstate->Target = header[2];
+	rockstate->Rocks.resize(NumRocks);
+	memcpy(rockstate->Rocks.data(), data + sizeof(header),
+		NumRocks * sizeof(ROCKSAMPLE_STATE::ENTRY));
+	return rockstate;
+}
+
 void ROCKSAMPLE::Validate(const STATE& state) const
 {
 	const ROCKSAMPLE_STATE& rockstate = safe_cast<const ROCKSAMPLE_STATE&>(state);
 	assert(Grid.Inside(rockstate.AgentPos));
 }
 
-STATE* ROCKSAMPLE::CreateStartState() const
+bool ROCKSAMPLE::HashState(const STATE& state, std::size_t& hash) const
 {
-	ROCKSAMPLE_STATE* rockstate = MemoryPool.Allocate();
-	rockstate->AgentPos = StartPos;
-	rockstate->Rocks.clear();
+	const ROCKSAMPLE_STATE& rockstate = safe_cast<const ROCKSAMPLE_STATE&>(state);
+	hash = rockstate.AgentPos.X * Size + rockstate.AgentPos.Y;
+	for (int i = 0; i < NumRocks; i++)
+	{
+		const ROCKSAMPLE_STATE::ENTRY& entry = rockstate.Rocks[i];
+		hash = hash * 31 + (entry.Type << 1 | entry.Collected);
+		hash = hash * 31 + (entry.Count << 8 | entry.Measured);
+	}
+	return true;
+}
+
+bool ROCKSAMPLE::EqualStates(const STATE& state1, const STATE& state2) const
+{
+	const ROCKSAMPLE_STATE& rockstate1 = safe_cast<const ROCKSAMPLE_STATE&>(state1);
+	const ROCKSAMPLE_STATE& rockstate2 = safe_cast<const ROCKSAMPLE_STATE&>(state2);
+	if (rockstate1.AgentPos != rockstate2.AgentPos
+		|| rockstate1.Target != rockstate2.Target)
+		return false;
+	for (int i = 0; i < NumRocks; i++)
+	{
+		const ROCKSAMPLE_STATE::ENTRY& entry1 = rockstate1.Rocks[i];
+		const ROCKSAMPLE_STATE::ENTRY& entry2 = rockstate2.Rocks[i];
+		if (entry1.Type != entry2.Type
+			|| entry1.Collected != entry2.Collected
+			|| entry1.Count != entry2.Count
+			|| entry1.Measured != entry2.Measured
+			|| entry1.LikelihoodValuable != entry2.LikelihoodValuable
+			|| entry1.LikelihoodWorthless != entry2.LikelihoodWorthless
+			|| entry1.ProbValuable != entry2.ProbValuable)
+			return false;
+	}
+	return true;
+}
+
+void ROCKSAMPLE::InitStartState(ROCKSAMPLE_STATE& rockstate) const
+{
+	rockstate.AgentPos = StartPos;
+	rockstate.Rocks.clear();
 	for (int i = 0; i < NumRocks; i++)
 	{
 		ROCKSAMPLE_STATE::ENTRY entry;
@@ -154,24 +229,54 @@ STATE* ROCKSAMPLE::CreateStartState() const
 		entry.ProbValuable = 0.5;
 		entry.LikelihoodValuable = 1.0;
 		entry.LikelihoodWorthless = 1.0;
-		rockstate->Rocks.push_back(entry);
+		rockstate.Rocks.push_back(entry);
 	}
-	std::vector<int> idx(NumRocks);
-	std:iota(std::begin(idx), std::end(idx), 0);
-	std::random_device device;
-	auto rng = std::default_random_engine {device()};
-	std::shuffle(std::begin(idx), std::end(idx), rng);
+	rockstate.Target = SelectTarget(rockstate);
+}
 
-    // assume full observable for layout rocksample(3, 3)
-    // std::vector<int> idx{2};
-	for (int i = 0; i < NumRocks / 2; i++) {
-		int id = idx[i];
-		rockstate->Rocks[id].Type = 1;
+template <class RNG>
+void ROCKSAMPLE::DrawRockTypes(ROCKSAMPLE_STATE& rockstate, RNG& rng) const
+{
+	// Half of the rocks are type 1: a partial shuffle picks which
+	static thread_local vector<int> idx;
+	idx.resize(NumRocks);
+	std::iota(idx.begin(), idx.end(), 0);
+	for (int i = 0; i < NumRocks / 2; i++)
+	{
+		int j = i + rng() % (NumRocks - i);
+		std::swap(idx[i], idx[j]);
+		rockstate.Rocks[idx[i]].Type = 1;
 	}
-	rockstate->Target = SelectTarget(*rockstate);
+}
+
+STATE* ROCKSAMPLE::CreateStartState() const
+{
+	// One engine per thread, seeded once, for the real start states
+	static thread_local std::default_random_engine rng{std::random_device()()};
+	ROCKSAMPLE_STATE* rockstate = MemoryPool.Allocate();
+	InitStartState(*rockstate);
+	DrawRockTypes(*rockstate, rng);
 	return rockstate;
 }
 
+void ROCKSAMPLE::CreateStartStates(int count, vector<STATE*>& states,
+	unsigned int seed) const
+{
+	ROCKSAMPLE_STATE start;
+	InitStartState(start);
+	std::minstd_rand rng(seed);
+	states.reserve(states.size() + count);
+	for (int i = 0; i < count; i++)
+	{
+		ROCKSAMPLE_STATE* rockstate = MemoryPool.Allocate();
+		rockstate->AgentPos = start.AgentPos;
+		rockstate->Rocks = start.Rocks;
+		rockstate->Target = start.Target;
+		DrawRockTypes(*rockstate, rng);
+		states.push_back(rockstate);
+	}
+}
+
 void ROCKSAMPLE::FreeState(STATE* state) const
 {
 	ROCKSAMPLE_STATE* rockstate = safe_cast<ROCKSAMPLE_STATE*>(state);
@@ -181,6 +286,12 @@ void ROCKSAMPLE::FreeState(STATE* state) const
 bool ROCKSAMPLE::Step(STATE& state, int action,
 	int& observation, vector<double>& reward) const
 {
+	if (IsMacro(action))
+	{
+		int steps;
+		return MacroStep(state, action, observation, reward, steps);
+	}
+
 	ROCKSAMPLE_STATE& rockstate = safe_cast<ROCKSAMPLE_STATE&>(state);
 	// reward = 0;
 	reward = {0.0, 0.0};
@@ -257,27 +368,7 @@ bool ROCKSAMPLE::Step(STATE& state, int action,
 		int rock = action - E_SAMPLE - 1;
 		assert(rock < NumRocks);
 		observation = GetObservation(rockstate, rock);
-		rockstate.Rocks[rock].Measured++;
-
-		double distance = COORD::EuclideanDistance(rockstate.AgentPos, RockPos[rock]);
-		double efficiency = (1 + pow(2, -distance / HalfEfficiencyDistance)) * 0.5;
-
-		if (observation == E_TYEP1)
-		{
-			rockstate.Rocks[rock].Count++;
-			rockstate.Rocks[rock].LikelihoodValuable *= efficiency;
-			rockstate.Rocks[rock].LikelihoodWorthless *= 1.0 - efficiency;
-
-		}
-		else
-		{
-			rockstate.Rocks[rock].Count--;
-			rockstate.Rocks[rock].LikelihoodWorthless *= efficiency;
-			rockstate.Rocks[rock].LikelihoodValuable *= 1.0 - efficiency;
-		}
-		double denom = (0.5 * rockstate.Rocks[rock].LikelihoodValuable) +
-			(0.5 * rockstate.Rocks[rock].LikelihoodWorthless);
-		rockstate.Rocks[rock].ProbValuable = (0.5 * rockstate.Rocks[rock].LikelihoodValuable) / denom;
+		UpdateKnowledge(rockstate, rock, observation);
 	}
 
 	if (rockstate.Target < 0 || rockstate.AgentPos == RockPos[rockstate.Target])
@@ -286,6 +377,101 @@ bool ROCKSAMPLE::Step(STATE& state, int action,
 	return false;
 }
 
+bool ROCKSAMPLE::MacroStep(STATE& state, int action,
+	int& observation, vector<double>& reward, int& steps) const
+{
+	if (!IsMacro(action))
+	{
+		steps = 1;
+		return Step(state, action, observation, reward);
+	}
+
+	ROCKSAMPLE_STATE& rockstate = safe_cast<ROCKSAMPLE_STATE&>(state);
+	reward = {0.0, 0.0};
+	observation = E_NONE;
+	steps = 0;
+
+	// Walk along X then Y to the rock, or east until leaving the grid
+	COORD target = action == ExitAction()
+		? COORD(Size, rockstate.AgentPos.Y) : RockPos[action - GotoAction(0)];
+	vector<double> stepReward;
+	double discount = 1.0;
+	while (!(rockstate.AgentPos == target))
+	{
+		int move;
+		if (rockstate.AgentPos.X < target.X)
+			move = COORD::E_EAST;
+		else if (rockstate.AgentPos.X > target.X)
+			move = COORD::E_WEST;
+		else if (rockstate.AgentPos.Y < target.Y)
+			move = COORD::E_NORTH;
+		else
+			move = COORD::E_SOUTH;
+
+		int stepObs;
+		bool terminal = Step(rockstate, move, stepObs, stepReward);
+		steps++;
+		for (int i = 0; i < 2; i++)
+			reward[i] += stepReward[i] * discount;
+		discount *= Discount;
+		if (terminal)
+			return true;
+	}
+	return false;
+}
+
+bool ROCKSAMPLE::StepUndoable(STATE& state, int action,
+	int& observation, vector<double>& reward, int& steps) const
+{
+	ROCKSAMPLE_STATE& rockstate = safe_cast<ROCKSAMPLE_STATE&>(state);
+	UNDO_ENTRY undo;
+	undo.AgentPos = rockstate.AgentPos;
+	undo.Target = rockstate.Target;
+	undo.Rock = action == E_SAMPLE ? Grid(rockstate.AgentPos) : GetCheckedRock(action);
+	if (undo.Rock >= 0)
+		undo.Entry = rockstate.Rocks[undo.Rock];
+	UndoLog.push_back(undo);
+	return MacroStep(state, action, observation, reward, steps);
+}
+
+void ROCKSAMPLE::Undo(STATE& state, int mark) const
+{
+	ROCKSAMPLE_STATE& rockstate = safe_cast<ROCKSAMPLE_STATE&>(state);
+	while ((int) UndoLog.size() > mark)
+	{
+		const UNDO_ENTRY& undo = UndoLog.back();
+		rockstate.AgentPos = undo.AgentPos;
+		rockstate.Target = undo.Target;
+		if (undo.Rock >= 0)
+			rockstate.Rocks[undo.Rock] = undo.Entry;
+		UndoLog.pop_back();
+	}
+}
+
+void ROCKSAMPLE::UpdateKnowledge(ROCKSAMPLE_STATE& rockstate, int rock, int observation) const
+{
+	rockstate.Rocks[rock].Measured++;
+
+	double efficiency = GetEfficiency(rockstate, rock);
+
+	if (observation == E_TYEP1)
+	{
+		rockstate.Rocks[rock].Count++;
+		rockstate.Rocks[rock].LikelihoodValuable *= efficiency;
+		rockstate.Rocks[rock].LikelihoodWorthless *= 1.0 - efficiency;
+
+	}
+	else
+	{
+		rockstate.Rocks[rock].Count--;
+		rockstate.Rocks[rock].LikelihoodWorthless *= efficiency;
+		rockstate.Rocks[rock].LikelihoodValuable *= 1.0 - efficiency;
+	}
+	double denom = (0.5 * rockstate.Rocks[rock].LikelihoodValuable) +
+		(0.5 * rockstate.Rocks[rock].LikelihoodWorthless);
+	rockstate.Rocks[rock].ProbValuable = (0.5 * rockstate.Rocks[rock].LikelihoodValuable) / denom;
+}
+
 bool ROCKSAMPLE::LocalMove(STATE& state, const HISTORY& history,
 	int stepObs, const STATUS& status) const
 {
@@ -293,9 +479,9 @@ bool ROCKSAMPLE::LocalMove(STATE& state, const HISTORY& history,
 	int rock = Random(NumRocks);
 	rockstate.Rocks[rock].Type = 1 - rockstate.Rocks[rock].Type;
 
-	if (history.Back().Action > E_SAMPLE) // check rock
+	if (GetCheckedRock(history.Back().Action) >= 0) // check rock
 	{
-		rock = history.Back().Action - E_SAMPLE - 1;
+		rock = GetCheckedRock(history.Back().Action);
 		int realObs = history.Back().Observation;
 
 		// Condition new state on real observation
@@ -312,6 +498,84 @@ bool ROCKSAMPLE::LocalMove(STATE& state, const HISTORY& history,
 	return true;
 }
 
+double ROCKSAMPLE::ObservationLikelihood(STATE& state, int action,
+	int stepObs, int observation) const
+{
+	ROCKSAMPLE_STATE& rockstate = safe_cast<ROCKSAMPLE_STATE&>(state);
+	int rock = GetCheckedRock(action);
+	if (rock < 0)
+		return observation == E_NONE ? 1.0 : 0.0;
+
+	double efficiency = GetEfficiency(rockstate, rock);
+	int correctObs = rockstate.Rocks[rock].Type ? E_TYPE2 : E_TYEP1;
+
+	// Update counts to be consistent with real observation
+	if (observation == E_TYEP1 && stepObs == E_TYPE2)
+		rockstate.Rocks[rock].Count += 2;
+	if (observation == E_TYPE2 && stepObs == E_TYEP1)
+		rockstate.Rocks[rock].Count -= 2;
+
+	return observation == correctObs ? efficiency : 1.0 - efficiency;
+}
+
+ANALYTIC_BELIEF* ROCKSAMPLE::CreateAnalyticBelief() const
+{
+	return new ROCKSAMPLE_BELIEF(*this);
+}
+
+bool ROCKSAMPLE::LeafValue(const STATE& state, vector<double>& value) const
+{
+	const ROCKSAMPLE_STATE& rockstate = safe_cast<const ROCKSAMPLE_STATE&>(state);
+
+	// Rollouts end at the first sampled rock, so estimate the expected reward
+	// of walking to the nearest remaining rock and sampling it, using the
+	// smart knowledge rather than the hidden type. No rocks left means exiting.
+	// Random rollouts reach distant rocks less often, so the estimate decays
+	// with distance even when undiscounted
+	int bestRock = -1, bestDist = 0;
+	for (int rock = 0; rock < NumRocks; ++rock)
+	{
+		if (rockstate.Rocks[rock].Collected)
+			continue;
+		int dist = COORD::ManhattanDistance(rockstate.AgentPos, RockPos[rock]);
+		if (bestRock < 0 || dist < bestDist || (dist == bestDist
+			&& rockstate.Rocks[rock].ProbValuable > rockstate.Rocks[bestRock].ProbValuable))
+		{
+			bestRock = rock;
+			bestDist = dist;
+		}
+	}
+
+	value.assign(2, 0.0);
+	if (bestRock >= 0)
+	{
+		double p = rockstate.Rocks[bestRock].ProbValuable;
+		if (!(p >= 0.0 && p <= 1.0)) // contradictory checks leave no likelihood
+			p = 0.5;
+		double discount = pow(Discount * LeafDecay, bestDist);
+		// ProbValuable is the probability of type 0, which pays {1, 9}
+		value[0] = discount * (p * 1 + (1 - p) * 9);
+		value[1] = discount * (p * 9 + (1 - p) * 1);
+	}
+	return true;
+}
+
+bool ROCKSAMPLE::RolloutKey(const STATE& state, std::uint64_t& key) const
+{
+	const ROCKSAMPLE_STATE& rockstate = safe_cast<const ROCKSAMPLE_STATE&>(state);
+	// Smart rollouts also depend on the check knowledge, which is not keyed
+	if (NumRocks > 24 || Knowledge.RolloutLevel >= KNOWLEDGE::SMART)
+		return false;
+
+	// Agent position, collected-rock mask and rock types, which together
+	// determine the distribution of rollout returns under legal knowledge
+	key = rockstate.AgentPos.X * Size + rockstate.AgentPos.Y;
+	for (int rock = 0; rock < NumRocks; ++rock)
+		key = (key << 2) | (rockstate.Rocks[rock].Collected ? 2 : 0)
+			| rockstate.Rocks[rock].Type;
+	return true;
+}
+
 void ROCKSAMPLE::GenerateLegal(const STATE& state, const HISTORY& history,
 	vector<int>& legal, const STATUS& status) const
 {
@@ -319,6 +583,12 @@ void ROCKSAMPLE::GenerateLegal(const STATE& state, const HISTORY& history,
 	const ROCKSAMPLE_STATE& rockstate =
 		safe_cast<const ROCKSAMPLE_STATE&>(state);
 
+	if (MacroActions)
+	{
+		GenerateMacroLegal(rockstate, legal);
+		return;
+	}
+
 	if (rockstate.AgentPos.Y + 1 < Size)
 		legal.push_back(COORD::E_NORTH);
 
@@ -339,6 +609,25 @@ void ROCKSAMPLE::GenerateLegal(const STATE& state, const HISTORY& history,
 			legal.push_back(rock + 1 + E_SAMPLE);
 }
 
+void ROCKSAMPLE::GenerateMacroLegal(const ROCKSAMPLE_STATE& rockstate,
+	vector<int>& legal) const
+{
+	int rock = Grid(rockstate.AgentPos);
+	if (rock >= 0 && !rockstate.Rocks[rock].Collected)
+		legal.push_back(E_SAMPLE);
+
+	for (rock = 0; rock < NumRocks; ++rock)
+	{
+		if (rockstate.Rocks[rock].Collected)
+			continue;
+		legal.push_back(rock + 1 + E_SAMPLE);
+		if (!(rockstate.AgentPos == RockPos[rock]))
+			legal.push_back(GotoAction(rock));
+	}
+
+	legal.push_back(ExitAction());
+}
+
 void ROCKSAMPLE::GeneratePreferred(const STATE& state, const HISTORY& history,
 	vector<int>& actions, const STATUS& status) const
 {
@@ -347,7 +636,7 @@ void ROCKSAMPLE::GeneratePreferred(const STATE& state, const HISTORY& history,
 
 	if (UseBlindPolicy)
 	{
-		actions.push_back(COORD::E_EAST);
+		actions.push_back(MacroActions ? ExitAction() : COORD::E_EAST);
 		return;
 	}
 
@@ -404,6 +693,8 @@ void ROCKSAMPLE::GeneratePreferred(const STATE& state, const HISTORY& history,
 			if (total >= 0)
 			{
 				all_bad = false;
+				if (MacroActions && !(rockstate.AgentPos == RockPos[rock]))
+					actions.push_back(GotoAction(rock));
 
 				if (RockPos[rock].Y > rockstate.AgentPos.Y)
 					north_interesting = true;
@@ -420,7 +711,7 @@ void ROCKSAMPLE::GeneratePreferred(const STATE& state, const HISTORY& history,
 	// if all remaining rocks seem bad, then head east
 	if (all_bad)
 	{
-		actions.push_back(COORD::E_EAST);
+		actions.push_back(MacroActions ? ExitAction() : COORD::E_EAST);
 		return;
 	}
 
@@ -431,17 +722,20 @@ void ROCKSAMPLE::GeneratePreferred(const STATE& state, const HISTORY& history,
 	//   d) we never sample a rock (since we need to be sure)
 	//   e) we never move in a direction that doesn't take us closer to
 	//      either the edge of the map or an interesting rock
-	if (rockstate.AgentPos.Y + 1 < Size && north_interesting)
-		actions.push_back(COORD::E_NORTH);
+	if (!MacroActions)
+	{
+		if (rockstate.AgentPos.Y + 1 < Size && north_interesting)
+			actions.push_back(COORD::E_NORTH);
 
-	if (east_interesting)
-		actions.push_back(COORD::E_EAST);
+		if (east_interesting)
+			actions.push_back(COORD::E_EAST);
 
-	if (rockstate.AgentPos.Y - 1 >= 0 && south_interesting)
-		actions.push_back(COORD::E_SOUTH);
+		if (rockstate.AgentPos.Y - 1 >= 0 && south_interesting)
+			actions.push_back(COORD::E_SOUTH);
 
-	if (rockstate.AgentPos.X - 1 >= 0 && west_interesting)
-		actions.push_back(COORD::E_WEST);
+		if (rockstate.AgentPos.X - 1 >= 0 && west_interesting)
+			actions.push_back(COORD::E_WEST);
+	}
 
 
 	for (rock = 0; rock < NumRocks; ++rock)
@@ -457,10 +751,15 @@ void ROCKSAMPLE::GeneratePreferred(const STATE& state, const HISTORY& history,
 	}
 }
 
-int ROCKSAMPLE::GetObservation(const ROCKSAMPLE_STATE& rockstate, int rock) const
+double ROCKSAMPLE::GetEfficiency(const ROCKSAMPLE_STATE& rockstate, int rock) const
 {
 	double distance = COORD::EuclideanDistance(rockstate.AgentPos, RockPos[rock]);
-	double efficiency = (1 + pow(2, -distance / HalfEfficiencyDistance)) * 0.5;
+	return (1 + pow(2, -distance / HalfEfficiencyDistance)) * 0.5;
+}
+
+int ROCKSAMPLE::GetObservation(const ROCKSAMPLE_STATE& rockstate, int rock) const
+{
+	double efficiency = GetEfficiency(rockstate, rock);
 
 	if (Bernoulli(efficiency))
 		return rockstate.Rocks[rock].Type ? E_TYPE2 : E_TYEP1;
@@ -488,6 +787,14 @@ int ROCKSAMPLE::SelectTarget(const ROCKSAMPLE_STATE& rockstate) const
 void ROCKSAMPLE::DisplayBeliefs(const BELIEF_STATE& beliefState,
 	std::ostream& ostr) const
 {
+	const ROCKSAMPLE_BELIEF* analytic =
+		dynamic_cast<const ROCKSAMPLE_BELIEF*>(beliefState.GetAnalytic());
+	if (!analytic)
+		return;
+	ostr << "P(type1):";
+	for (int rock = 0; rock < NumRocks; ++rock)
+		ostr << " " << analytic->GetProbType1(rock);
+	ostr << endl;
 }
 
 void ROCKSAMPLE::DisplayState(const STATE& state, std::ostream& ostr) const
@@ -540,6 +847,376 @@ void ROCKSAMPLE::DisplayAction(int action, std::ostream& ostr) const
 		ostr << COORD::CompassString[action] << endl;
 	if (action == E_SAMPLE)
 		ostr << "Sample" << endl;
-	if (action > E_SAMPLE)
+	if (GetCheckedRock(action) >= 0)
 		ostr << "Check " << action - E_SAMPLE << endl;
+	if (IsMacro(action) && action != ExitAction())
+		ostr << "Go to " << action - GotoAction(0) << endl;
+	if (action == ExitAction())
+		ostr << "Exit" << endl;
+}
+
+//-----------------------------------------------------------------------------
+
+ROCKSAMPLE_BELIEF::ROCKSAMPLE_BELIEF(const ROCKSAMPLE& rocksample)
+	: RockSample(rocksample),
+	Likelihood0(rocksample.NumRocks, 1.0),
+	Likelihood1(rocksample.NumRocks, 1.0),
+	NumType1(rocksample.NumRocks / 2)
+{
+	STATE* start = RockSample.CreateStartState();
+	Observed = safe_cast<ROCKSAMPLE_STATE&>(*start);
+	RockSample.FreeState(start);
+	UpdateWeights();
+}
+
+STATE* ROCKSAMPLE_BELIEF::CreateSample(const SIMULATOR& simulator) const
+{
+	ROCKSAMPLE_STATE* rockstate = safe_cast<ROCKSAMPLE_STATE*>(simulator.Copy(Observed));
+
+	// Draw types rock by rock, conditioned on the type 1 rocks still to place
+	int remaining = NumType1;
+	for (int i = 0; i < RockSample.NumRocks; i++)
+	{
+		double type1 = remaining > 0 ? Likelihood1[i] * Weights[i + 1][remaining - 1] : 0;
+		int type = Bernoulli(type1 / Weights[i][remaining]) ? 1 : 0;
+		rockstate->Rocks[i].Type = type;
+		remaining -= type;
+	}
+	assert(remaining == 0);
+	return rockstate;
+}
+
+void ROCKSAMPLE_BELIEF::Update(int action, int observation,
+	const std::vector<double>& reward)
+{
+	if (action < ROCKSAMPLE::E_SAMPLE || RockSample.IsMacro(action)) // moves are independent of rock types
+	{
+		int stepObs;
+		std::vector<double> stepReward;
+		RockSample.Step(Observed, action, stepObs, stepReward);
+		return;
+	}
+
+	if (action == ROCKSAMPLE::E_SAMPLE) // sample reveals the type
+	{
+		int rock = RockSample.Grid(Observed.AgentPos);
+		if (rock < 0 || Observed.Rocks[rock].Collected)
+			return;
+		Observed.Rocks[rock].Collected = true;
+		if (reward[0] > reward[1]) // type 1: {9, 1}
+			Likelihood0[rock] = 0.0;
+		else
+			Likelihood1[rock] = 0.0;
+	}
+	else // check
+	{
+		int rock = RockSample.GetCheckedRock(action);
+		double efficiency = RockSample.GetEfficiency(Observed, rock);
+		bool looksType0 = observation == ROCKSAMPLE::E_TYEP1;
+		Likelihood0[rock] *= looksType0 ? efficiency : 1.0 - efficiency;
+		Likelihood1[rock] *= looksType0 ? 1.0 - efficiency : efficiency;
+		RockSample.UpdateKnowledge(Observed, rock, observation);
+	}
+
+	for (int i = 0; i < RockSample.NumRocks; i++)
+	{
+		double total = Likelihood0[i] + Likelihood1[i];
+		Likelihood0[i] /= total;
+		Likelihood1[i] /= total;
+	}
+
+	if (Observed.Target < 0 || Observed.AgentPos == RockSample.RockPos[Observed.Target])
+		Observed.Target = RockSample.SelectTarget(Observed);
+	UpdateWeights();
+}
+
+ANALYTIC_BELIEF* ROCKSAMPLE_BELIEF::Clone() const
+{
+	return new ROCKSAMPLE_BELIEF(*this);
+}
+
+double ROCKSAMPLE_BELIEF::GetProbType1(int rock) const
+{
+	// Type 1 weight of this rock times all ways to place the rest
+	double type1 = 0, total = Weights[0][NumType1];
+	std::vector<double> prefix(NumType1 + 1, 0.0), next;
+	prefix[0] = 1.0;
+	for (int i = 0; i < rock; i++)
+	{
+		next.assign(NumType1 + 1, 0.0);
+		for (int k = 0; k <= NumType1; k++)
+		{
+			next[k] += prefix[k] * Likelihood0[i];
+			if (k < NumType1)
+				next[k + 1] += prefix[k] * Likelihood1[i];
+		}
+		prefix.swap(next);
+	}
+	for (int k = 0; k < NumType1; k++)
+		type1 += prefix[k] * Likelihood1[rock] * Weights[rock + 1][NumType1 - k - 1];
+	return total > 0 ? type1 / total : 0;
+}
+
+void ROCKSAMPLE_BELIEF::UpdateWeights()
+{
+	int numRocks = RockSample.NumRocks;
+	Weights.assign(numRocks + 1, std::vector<double>(NumType1 + 1, 0.0));
+	Weights[numRocks][0] = 1.0;
+	for (int i = numRocks - 1; i >= 0; i--)
+	{
+		for (int k = 0; k <= NumType1; k++)
+		{
+			Weights[i][k] = Likelihood0[i] * Weights[i + 1][k];
+			if (k > 0)
+				Weights[i][k] += Likelihood1[i] * Weights[i + 1][k - 1];
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+
+void ROCKSAMPLE::UnitTest()
+{
+	UnitTestLeafValue();
+	UnitTestUndo();
+	UnitTestReweight();
+	UnitTestCompact();
+	UnitTestScratchSample();
+	UnitTestStartStates();
+	UnitTestAnalyticBelief();
+	UnitTestMacroActions();
+}
+
+void ROCKSAMPLE::UnitTestLeafValue()
+{
+	// A rock of known type standing under the agent is worth what sampling pays
+	ROCKSAMPLE rocksample(7, 8, 2);
+	for (int type = 0; type < 2; type++)
+	{
+		STATE* state = rocksample.CreateStartState();
+		ROCKSAMPLE_STATE& rockstate = safe_cast<ROCKSAMPLE_STATE&>(*state);
+		rockstate.AgentPos = rocksample.RockPos[0];
+		rockstate.Rocks[0].Type = type;
+		rockstate.Rocks[0].ProbValuable = type == 0 ? 1.0 : 0.0;
+
+		vector<double> value, reward;
+		bool estimated = rocksample.LeafValue(*state, value);
+		int observation;
+		rocksample.Step(*state, E_SAMPLE, observation, reward);
+		assert(estimated && value == reward);
+		rocksample.FreeState(state);
+	}
+}
+
+void ROCKSAMPLE::UnitTestUndo()
+{
+	// Undoing a run of steps, macro actions included, restores every field
+	ROCKSAMPLE rocksample(7, 8, 2, true);
+	STATE* state = rocksample.CreateStartState();
+	STATE* copy = rocksample.Copy(*state);
+	const ROCKSAMPLE_STATE& rockstate = safe_cast<const ROCKSAMPLE_STATE&>(*state);
+	const ROCKSAMPLE_STATE& original = safe_cast<const ROCKSAMPLE_STATE&>(*copy);
+
+	HISTORY history;
+	STATUS status;
+	int mark = rocksample.UndoMark();
+	for (int i = 0; i < 20; i++)
+	{
+		vector<int> legal;
+		rocksample.GenerateLegal(*state, history, legal, status);
+		int observation, steps;
+		vector<double> reward;
+		if (rocksample.StepUndoable(*state, legal[Random(legal.size())],
+			observation, reward, steps))
+			break;
+	}
+	rocksample.Undo(*state, mark);
+	assert(rocksample.UndoMark() == mark);
+
+	assert(rockstate.AgentPos == original.AgentPos);
+	assert(rockstate.Target == original.Target);
+	for (int i = 0; i < rocksample.NumRocks; i++)
+	{
+		const ROCKSAMPLE_STATE::ENTRY& entry = rockstate.Rocks[i];
+		const ROCKSAMPLE_STATE::ENTRY& expected = original.Rocks[i];
+		assert(entry.Type == expected.Type);
+		assert(entry.Collected == expected.Collected);
+		assert(entry.Count == expected.Count);
+		assert(entry.Measured == expected.Measured);
+		assert(entry.LikelihoodValuable == expected.LikelihoodValuable);
+		assert(entry.LikelihoodWorthless == expected.LikelihoodWorthless);
+		assert(entry.ProbValuable == expected.ProbValuable);
+	}
+	rocksample.FreeState(copy);
+	rocksample.FreeState(state);
+}
+
+void ROCKSAMPLE::UnitTestReweight()
+{
+	// Checks that keep reporting type 0 shift the resampled particles towards
+	// it, without changing the size of the particle set
+	ROCKSAMPLE rocksample(7, 8, 2);
+	MCTS::PARAMS params;
+	params.NumStartStates = 1000;
+	params.WeightedBelief = true;
+	MCTS mcts(rocksample, params);
+	vector<double> reward(2, 0.0);
+	int check = E_SAMPLE + 1;
+	for (int i = 0; i < 3; i++)
+		assert(mcts.Update(check, E_TYEP1, reward));
+
+	const BELIEF_STATE& beliefs = mcts.BeliefState();
+	assert(beliefs.GetNumParticles() == params.NumStartStates);
+	int type0 = 0;
+	for (int i = 0; i < beliefs.GetNumSamples(); i++)
+		if (safe_cast<const ROCKSAMPLE_STATE&>(*beliefs.GetSample(i)).Rocks[0].Type == 0)
+			type0 += beliefs.GetCount(i);
+	assert(type0 > 0.75 * params.NumStartStates);
+}
+
+void ROCKSAMPLE::UnitTestCompact()
+{
+	// Start states differ only in rock types, so they merge into at most
+	// 8 choose 4 unique states while keeping every particle's weight
+	ROCKSAMPLE rocksample(7, 8, 2);
+	BELIEF_STATE beliefs;
+	for (int i = 0; i < 1000; i++)
+		beliefs.AddSample(rocksample.CreateStartState());
+	beliefs.AddSample(rocksample.CreateStartState(), 5);
+	beliefs.Compact(rocksample);
+	assert(beliefs.GetNumParticles() == 1005);
+	assert(beliefs.GetNumSamples() <= 70);
+	int total = 0;
+	for (int i = 0; i < beliefs.GetNumSamples(); i++)
+	{
+		total += beliefs.GetCount(i);
+		for (int j = 0; j < i; j++)
+			assert(!rocksample.EqualStates(*beliefs.GetSample(i), *beliefs.GetSample(j)));
+	}
+	assert(total == 1005);
+
+	// Compacting again changes nothing
+	int numSamples = beliefs.GetNumSamples();
+	beliefs.Compact(rocksample);
+	assert(beliefs.GetNumSamples() == numSamples && beliefs.GetNumParticles() == 1005);
+	beliefs.Free(rocksample);
+}
+
+void ROCKSAMPLE::UnitTestScratchSample()
+{
+	// Sampling into a scratch state overwrites it with an equal particle
+	ROCKSAMPLE rocksample(7, 8, 2);
+	BELIEF_STATE beliefs;
+	STATE* particle = rocksample.CreateStartState();
+	beliefs.AddSample(particle);
+	STATE* scratch = rocksample.Copy(*particle);
+	safe_cast<ROCKSAMPLE_STATE&>(*scratch).AgentPos.X++;
+	assert(!rocksample.EqualStates(*scratch, *particle));
+	assert(beliefs.SampleInto(rocksample, *scratch));
+	assert(rocksample.EqualStates(*scratch, *particle));
+	rocksample.FreeState(scratch);
+
+	// Moving the particles hands over the same states, leaving the source empty
+	BELIEF_STATE moved;
+	moved.Move(beliefs);
+	assert(beliefs.GetNumSamples() == 0);
+	assert(moved.GetNumSamples() == 1 && moved.GetSample(0) == particle);
+	moved.Free(rocksample);
+}
+
+void ROCKSAMPLE::UnitTestStartStates()
+{
+	// A seed reproduces its batch, appended after any existing states, and
+	// every start state has half of its rocks of type 1
+	ROCKSAMPLE rocksample(7, 8, 2);
+	vector<STATE*> first, second, other;
+	first.push_back(rocksample.CreateStartState());
+	rocksample.CreateStartStates(100, first, 7);
+	rocksample.CreateStartStates(100, second, 7);
+	rocksample.CreateStartStates(100, other, 8);
+	assert(first.size() == 101 && second.size() == 100 && other.size() == 100);
+	bool differs = false;
+	for (int i = 0; i < 100; i++)
+	{
+		assert(rocksample.EqualStates(*first[i + 1], *second[i]));
+		differs = differs || !rocksample.EqualStates(*second[i], *other[i]);
+		const ROCKSAMPLE_STATE& rockstate = safe_cast<const ROCKSAMPLE_STATE&>(*second[i]);
+		int type1 = 0;
+		for (int r = 0; r < rocksample.NumRocks; r++)
+			type1 += rockstate.Rocks[r].Type == 1;
+		assert(type1 == rocksample.NumRocks / 2);
+	}
+	assert(differs);
+	for (STATE* state : first)
+		rocksample.FreeState(state);
+	for (int i = 0; i < 100; i++)
+	{
+		rocksample.FreeState(second[i]);
+		rocksample.FreeState(other[i]);
+	}
+}
+
+void ROCKSAMPLE::UnitTestAnalyticBelief()
+{
+	// The closed-form posterior matches enumerating every placement of the
+	// type 1 rocks, weighted by the likelihood of the checks
+	ROCKSAMPLE rocksample(7, 8, 2);
+	STATE* start = rocksample.CreateStartState();
+	const ROCKSAMPLE_STATE& rockstate = safe_cast<const ROCKSAMPLE_STATE&>(*start);
+	ROCKSAMPLE_BELIEF belief(rocksample);
+	int rocks[3] = { 0, 1, 0 };
+	int observations[3] = { E_TYEP1, E_TYPE2, E_TYEP1 };
+	vector<double> reward(2, 0.0);
+	for (int c = 0; c < 3; c++)
+		belief.Update(E_SAMPLE + 1 + rocks[c], observations[c], reward);
+
+	int numRocks = rocksample.NumRocks;
+	vector<double> type1(numRocks, 0.0);
+	double total = 0;
+	for (int types = 0; types < (1 << numRocks); types++)
+	{
+		if (__builtin_popcount(types) != numRocks / 2)
+			continue;
+		double weight = 1;
+		for (int c = 0; c < 3; c++)
+		{
+			double efficiency = rocksample.GetEfficiency(rockstate, rocks[c]);
+			bool correct = (observations[c] == E_TYPE2) == (((types >> rocks[c]) & 1) == 1);
+			weight *= correct ? efficiency : 1 - efficiency;
+		}
+		total += weight;
+		for (int i = 0; i < numRocks; i++)
+			if ((types >> i) & 1)
+				type1[i] += weight;
+	}
+	for (int i = 0; i < numRocks; i++)
+		assert(fabs(belief.GetProbType1(i) - type1[i] / total) < 1e-9);
+	rocksample.FreeState(start);
+}
+
+void ROCKSAMPLE::UnitTestMacroActions()
+{
+	// Going to a rock walks the Manhattan distance and stops on it
+	ROCKSAMPLE rocksample(7, 8, 2, true);
+	for (int rock = 0; rock < rocksample.NumRocks; rock++)
+	{
+		STATE* state = rocksample.CreateStartState();
+		ROCKSAMPLE_STATE& rockstate = safe_cast<ROCKSAMPLE_STATE&>(*state);
+		COORD start = rockstate.AgentPos;
+		int observation, steps;
+		vector<double> reward;
+		bool terminal = rocksample.MacroStep(*state, rocksample.GotoAction(rock),
+			observation, reward, steps);
+		assert(!terminal && observation == E_NONE);
+		assert(rockstate.AgentPos == rocksample.RockPos[rock]);
+		assert(steps == COORD::ManhattanDistance(start, rockstate.AgentPos));
+		assert(reward == vector<double>(2, 0.0));
+
+		// Exiting walks east off the grid and ends the episode
+		int x = rockstate.AgentPos.X;
+		terminal = rocksample.MacroStep(*state, rocksample.ExitAction(),
+			observation, reward, steps);
+		assert(terminal && steps == rocksample.Size - x);
+		rocksample.FreeState(state);
+	}
 }
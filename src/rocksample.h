@@ -28,18 +28,64 @@ public:
 	int Target; // Smart knowledge
 };
 
+class ROCKSAMPLE;
+
+// Exact belief over rock types: independent per-rock check likelihoods,
+// conditioned on exactly half of the rocks being of type 1
+class ROCKSAMPLE_BELIEF : public ANALYTIC_BELIEF
+{
+public:
+
+	ROCKSAMPLE_BELIEF(const ROCKSAMPLE& rocksample);
+
+	virtual STATE* CreateSample(const SIMULATOR& simulator) const;
+	virtual void Update(int action, int observation,
+		const std::vector<double>& reward);
+	virtual ANALYTIC_BELIEF* Clone() const;
+
+	// Posterior probability of each rock being of type 1
+	double GetProbType1(int rock) const;
+
+private:
+
+	void UpdateWeights();
+
+	const ROCKSAMPLE& RockSample;
+	ROCKSAMPLE_STATE Observed; // fully observable part and smart knowledge
+	std::vector<double> Likelihood0, Likelihood1;
+	int NumType1;
+	// Weights[i][k]: total likelihood of rocks i.. containing k of type 1
+	std::vector<std::vector<double> > Weights;
+};
+
 class ROCKSAMPLE : public SIMULATOR
 {
+	friend class ROCKSAMPLE_BELIEF;
 public:
 
-	ROCKSAMPLE(int size, int rocks, int numObjectives);
+	ROCKSAMPLE(int size, int rocks, int numObjectives, bool macroActions = false);
 
 	virtual STATE* Copy(const STATE& state) const;
+	virtual bool CopyInto(const STATE& state, STATE& target) const;
 	virtual void Validate(const STATE& state) const;
+	virtual int GetPackedSize() const;
+	virtual void PackState(const STATE& state, char* data) const;
+	virtual STATE* UnpackState(const char* data) const;
+	virtual bool HashState(const STATE& state, std::size_t& hash) const;
+	virtual bool EqualStates(const STATE& state1, const STATE& state2) const;
 	virtual STATE* CreateStartState() const;
+	virtual void CreateStartStates(int count, std::vector<STATE*>& states,
+		unsigned int seed) const;
 	virtual void FreeState(STATE* state) const;
 	virtual bool Step(STATE& state, int action,
 		int& observation, std::vector<double>& reward) const;
+	virtual bool MacroStep(STATE& state, int action,
+		int& observation, std::vector<double>& reward, int& steps) const;
+	virtual bool CanUndo() const { return true; }
+	virtual bool StepUndoable(STATE& state, int action,
+		int& observation, std::vector<double>& reward, int& steps) const;
+	virtual int UndoMark() const { return UndoLog.size(); }
+	virtual void Undo(STATE& state, int mark) const;
 
 	void GenerateLegal(const STATE& state, const HISTORY& history,
 		std::vector<int>& legal, const STATUS& status) const;
@@ -47,6 +93,11 @@ public:
 		std::vector<int>& legal, const STATUS& status) const;
 	virtual bool LocalMove(STATE& state, const HISTORY& history,
 		int stepObservation, const STATUS& status) const;
+	virtual double ObservationLikelihood(STATE& state, int action,
+		int stepObs, int observation) const;
+	virtual ANALYTIC_BELIEF* CreateAnalyticBelief() const;
+	virtual bool LeafValue(const STATE& state, std::vector<double>& value) const;
+	virtual bool RolloutKey(const STATE& state, std::uint64_t& key) const;
 
 	virtual void DisplayBeliefs(const BELIEF_STATE& beliefState,
 		std::ostream& ostr) const;
@@ -54,6 +105,8 @@ public:
 	virtual void DisplayObservation(const STATE& state, int observation, std::ostream& ostr) const;
 	virtual void DisplayAction(int action, std::ostream& ostr) const;
 
+	static void UnitTest();
+
 protected:
 
 	enum
@@ -73,16 +126,53 @@ protected:
 	void Init_7_8();
 	void Init_11_11();
 	int GetObservation(const ROCKSAMPLE_STATE& rockstate, int rock) const;
+	double GetEfficiency(const ROCKSAMPLE_STATE& rockstate, int rock) const;
+	void UpdateKnowledge(ROCKSAMPLE_STATE& rockstate, int rock, int observation) const;
 	int SelectTarget(const ROCKSAMPLE_STATE& rockstate) const;
+	void InitStartState(ROCKSAMPLE_STATE& rockstate) const;
+	template <class RNG>
+	void DrawRockTypes(ROCKSAMPLE_STATE& rockstate, RNG& rng) const;
+	void GenerateMacroLegal(const ROCKSAMPLE_STATE& rockstate,
+		std::vector<int>& legal) const;
+
+	static void UnitTestLeafValue();
+	static void UnitTestUndo();
+	static void UnitTestReweight();
+	static void UnitTestCompact();
+	static void UnitTestScratchSample();
+	static void UnitTestStartStates();
+	static void UnitTestAnalyticBelief();
+	static void UnitTestMacroActions();
+
+	// Macro actions follow the checks: go to rock i, then exit east
+	int GetCheckedRock(int action) const
+	{
+		return action > E_SAMPLE && action <= E_SAMPLE + NumRocks ? action - E_SAMPLE - 1 : -1;
+	}
+	int GotoAction(int rock) const { return E_SAMPLE + 1 + NumRocks + rock; }
+	int ExitAction() const { return E_SAMPLE + 1 + 2 * NumRocks; }
+	bool IsMacro(int action) const { return action >= GotoAction(0); }
 
 	GRID<int> Grid;
 	std::vector<COORD> RockPos;
 	int Size, NumRocks;
+	bool MacroActions;
 	COORD StartPos;
 	double HalfEfficiencyDistance;
+	double LeafDecay; // per-step attenuation of the leaf value
 	double SmartMoveProb;
 	int UncertaintyCount;
 
+	// A step changes at most the position, the target and one rock
+	struct UNDO_ENTRY
+	{
+		COORD AgentPos;
+		int Target;
+		int Rock;
+		ROCKSAMPLE_STATE::ENTRY Entry;
+	};
+	static thread_local std::vector<UNDO_ENTRY> UndoLog;
+
 private:
 
 	mutable MEMORY_POOL<ROCKSAMPLE_STATE> MemoryPool;
@@ -0,0 +1,103 @@
+#ifndef ROLLOUT_CACHE_H
+#define ROLLOUT_CACHE_H
+
+#include "utils.h"
+#include <vector>
+#include <atomic>
+#include <cstdint>
+
+// Bounded open-addressing table of running mean rollout returns, keyed by a
+// compact simulator key. Lock-free: slots are claimed by compare-and-swap on
+// the key, and lookups that find the table full fall back to a real rollout
+class ROLLOUT_CACHE
+{
+public:
+
+	ROLLOUT_CACHE(int capacity, int numObjectives)
+		: Mask(RoundUp(capacity) - 1),
+		NumObjectives(numObjectives),
+		Keys(Mask + 1),
+		Counts(Mask + 1),
+		Totals((Mask + 1) * numObjectives)
+	{
+		Clear();
+	}
+
+	void Clear()
+	{
+		for (std::size_t i = 0; i <= Mask; ++i)
+		{
+			Keys[i].store(EMPTY, std::memory_order_relaxed);
+			Counts[i].store(0, std::memory_order_relaxed);
+		}
+		for (std::size_t i = 0; i < Totals.size(); ++i)
+			Totals[i].store(0.0, std::memory_order_relaxed);
+	}
+
+	// Mean return for key, if at least minCount rollouts have been recorded
+	bool Lookup(std::uint64_t key, int minCount, std::vector<double>& value) const
+	{
+		int slot = Find(key, false);
+		if (slot < 0)
+			return false;
+		int count = Counts[slot].load(std::memory_order_acquire);
+		if (count < minCount)
+			return false;
+		value.resize(NumObjectives);
+		for (int i = 0; i < NumObjectives; i++)
+			value[i] = Totals[slot * NumObjectives + i].load(std::memory_order_relaxed) / count;
+		return true;
+	}
+
+	void Add(std::uint64_t key, const std::vector<double>& value)
+	{
+		int slot = Find(key, true);
+		if (slot < 0)
+			return;
+		for (int i = 0; i < NumObjectives; i++)
+			UTILS::AtomicAdd(Totals[slot * NumObjectives + i], value[i]);
+		Counts[slot].fetch_add(1, std::memory_order_release);
+	}
+
+private:
+
+	static const std::uint64_t EMPTY = ~std::uint64_t(0);
+	static const int MAX_PROBES = 16;
+
+	static std::size_t RoundUp(int capacity)
+	{
+		std::size_t size = 1;
+		while (size < (std::size_t) capacity)
+			size <<= 1;
+		return size;
+	}
+
+	int Find(std::uint64_t key, bool insert) const
+	{
+		assert(key != EMPTY);
+		std::size_t slot = (key * 0x9E3779B97F4A7C15ull) >> 32 & Mask;
+		for (int probe = 0; probe < MAX_PROBES; ++probe, slot = (slot + 1) & Mask)
+		{
+			std::uint64_t current = Keys[slot].load(std::memory_order_acquire);
+			if (current == key)
+				return slot;
+			if (current == EMPTY)
+			{
+				if (!insert)
+					return -1;
+				if (Keys[slot].compare_exchange_strong(current, key,
+					std::memory_order_acq_rel) || current == key)
+					return slot;
+			}
+		}
+		return -1;
+	}
+
+	std::size_t Mask;
+	int NumObjectives;
+	mutable std::vector<std::atomic<std::uint64_t> > Keys;
+	std::vector<std::atomic<int> > Counts;
+	std::vector<std::atomic<double> > Totals;
+};
+
+#endif // ROLLOUT_CACHE_H
@@ -29,7 +29,8 @@ SIMULATOR::SIMULATOR(int numActions, int numObservations, int numObjectives, dou
 	: NumActions(numActions),
 	NumObservations(numObservations),
 	NumObjectives(numObjectives),
-	Discount(discount)
+	Discount(discount),
+	RewardRange(1.0)
 {
 	assert(discount > 0 && discount <= 1);
 }
@@ -42,12 +43,98 @@ void SIMULATOR::Validate(const STATE& state) const
 {
 }
 
+bool SIMULATOR::MacroStep(STATE& state, int action,
+	int& observation, std::vector<double>& reward, int& steps) const
+{
+	steps = 1;
+	return Step(state, action, observation, reward);
+}
+
+void SIMULATOR::CreateStartStates(int count, std::vector<STATE*>& states,
+	unsigned int) const
+{
+	for (int i = 0; i < count; i++)
+		states.push_back(CreateStartState());
+}
+
+int SIMULATOR::GetPackedSize() const
+{
+	return 0;
+}
+
+void SIMULATOR::PackState(const STATE&, char*) const
+{
+	assert(false);
+}
+
+STATE* SIMULATOR::UnpackState(const char*) const
+{
+	assert(false);
+	return 0;
+}
+
+bool SIMULATOR::CanUndo() const
+{
+	return false;
+}
+
+bool SIMULATOR::StepUndoable(STATE& state, int action,
+	int& observation, std::vector<double>& reward, int& steps) const
+{
+	return MacroStep(state, action, observation, reward, steps);
+}
+
+int SIMULATOR::UndoMark() const
+{
+	return 0;
+}
+
+void SIMULATOR::Undo(STATE&, int) const
+{
+	assert(false);
+}
+
+bool SIMULATOR::CopyInto(const STATE&, STATE&) const
+{
+	return false;
+}
+
+bool SIMULATOR::HashState(const STATE&, std::size_t&) const
+{
+	return false;
+}
+
+bool SIMULATOR::EqualStates(const STATE&, const STATE&) const
+{
+	return false;
+}
+
 bool SIMULATOR::LocalMove(STATE& state, const HISTORY& history,
 	int stepObs, const STATUS& status) const
 {
 	return true;
 }
 
+double SIMULATOR::ObservationLikelihood(STATE&, int, int, int) const
+{
+	return -1;
+}
+
+ANALYTIC_BELIEF* SIMULATOR::CreateAnalyticBelief() const
+{
+	return 0;
+}
+
+bool SIMULATOR::LeafValue(const STATE&, std::vector<double>&) const
+{
+	return false;
+}
+
+bool SIMULATOR::RolloutKey(const STATE&, std::uint64_t&) const
+{
+	return false;
+}
+
 void SIMULATOR::GenerateLegal(const STATE& state, const HISTORY& history,
 	std::vector<int>& actions, const STATUS& status) const
 {
@@ -63,7 +150,7 @@ void SIMULATOR::GeneratePreferred(const STATE& state, const HISTORY& history,
 int SIMULATOR::SelectRandom(const STATE& state, const HISTORY& history,
 	const STATUS& status) const
 {
-	static vector<int> actions;
+	static thread_local vector<int> actions;
 	if (Knowledge.RolloutLevel >= KNOWLEDGE::SMART)
 	{
 		actions.clear();
@@ -86,7 +173,7 @@ int SIMULATOR::SelectRandom(const STATE& state, const HISTORY& history,
 void SIMULATOR::Prior(const STATE* state, const HISTORY& history,
 	VNODE* vnode, const STATUS& status) const
 {
-	static vector<int> actions;
+	static thread_local vector<int> actions;
 
 	if (Knowledge.TreeLevel == KNOWLEDGE::PURE || state == 0)
 	{
@@ -6,6 +6,7 @@
 #include "utils.h"
 #include <iostream>
 #include <math.h>
+#include <cstdint>
 
 class BELIEF_STATE;
 
@@ -74,6 +75,10 @@ public:
 	// Create start start state (can be stochastic)
 	virtual STATE* CreateStartState() const = 0;
 
+	// Append count start states drawn from one engine seeded by seed
+	virtual void CreateStartStates(int count, std::vector<STATE*>& states,
+		unsigned int seed) const;
+
 	// Free memory for state
 	virtual void FreeState(STATE* state) const = 0;
 
@@ -82,16 +87,63 @@ public:
 	virtual bool Step(STATE& state, int action,
 		int& observation, std::vector<double>& reward) const = 0;
 
+	// Step that also reports the number of primitive steps taken, for
+	// temporally extended actions. The reward is discounted from the start
+	// of the action
+	virtual bool MacroStep(STATE& state, int action,
+		int& observation, std::vector<double>& reward, int& steps) const;
+
+	// Reversible MacroStep: also records in a per-thread undo log how to
+	// restore the state, so Undo can roll it back to an earlier UndoMark.
+	// Only used when CanUndo returns true
+	virtual bool CanUndo() const;
+	virtual bool StepUndoable(STATE& state, int action,
+		int& observation, std::vector<double>& reward, int& steps) const;
+	virtual int UndoMark() const;
+	virtual void Undo(STATE& state, int mark) const;
+
 	// Create new state and copy argument (must be same type)
 	virtual STATE* Copy(const STATE& state) const = 0;
 
+	// Overwrite an existing state with a copy of another, reusing its memory.
+	// Returns false if the simulator does not support it
+	virtual bool CopyInto(const STATE& state, STATE& target) const;
+
+	// Fixed-size binary form of a state for checkpoints.
+	// GetPackedSize returns 0 if the simulator does not support packing
+	virtual int GetPackedSize() const;
+	virtual void PackState(const STATE& state, char* data) const;
+	virtual STATE* UnpackState(const char* data) const;
+
 	// Sanity check
 	virtual void Validate(const STATE& state) const;
 
+	// Hash and compare states, used to merge duplicate particles.
+	// HashState returns false if the simulator does not support hashing
+	virtual bool HashState(const STATE& state, std::size_t& hash) const;
+	virtual bool EqualStates(const STATE& state1, const STATE& state2) const;
+
 	// Modify state stochastically to some related state
 	virtual bool LocalMove(STATE& state, const HISTORY& history,
 		int stepObs, const STATUS& status) const;
 
+	// Likelihood of the real observation in a state reached by the step
+	// that produced stepObs, making the state consistent with the real
+	// observation. Negative if the simulator has no observation model
+	virtual double ObservationLikelihood(STATE& state, int action,
+		int stepObs, int observation) const;
+
+	// Closed-form start belief, or 0 if the simulator only supports particles
+	virtual ANALYTIC_BELIEF* CreateAnalyticBelief() const;
+
+	// Heuristic estimate of the remaining vector return, used to cut rollouts
+	// short. Returns false if the simulator has no leaf evaluation
+	virtual bool LeafValue(const STATE& state, std::vector<double>& value) const;
+
+	// Compact key of the observable state that determines rollout returns,
+	// used to cache them. Returns false if the state cannot be keyed
+	virtual bool RolloutKey(const STATE& state, std::uint64_t& key) const;
+
 	// Use domain knowledge to assign prior value and confidence to actions
 	// Should only use fully observable state variables
 	void Prior(const STATE* state, const HISTORY& history, VNODE* vnode,
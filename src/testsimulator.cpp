@@ -1,5 +1,6 @@
 #include "testsimulator.h"
 #include "utils.h"
+#include <cstring>
 
 using namespace UTILS;
 
@@ -18,18 +19,33 @@ STATE* TEST_SIMULATOR::CreateStartState() const
 
 void TEST_SIMULATOR::FreeState(STATE* state) const
 {
-	delete state;
+	delete safe_cast<TEST_STATE*>(state);
+}
+
+int TEST_SIMULATOR::GetPackedSize() const
+{
+	return sizeof(int);
+}
+
+void TEST_SIMULATOR::PackState(const STATE& state, char* data) const
+{
+	const TEST_STATE& tstate = safe_cast<const TEST_STATE&>(state);
+	memcpy(data, &tstate.Depth, sizeof(int));
+}
+
+STATE* TEST_SIMULATOR::UnpackState(const char* data) const
+{
+	TEST_STATE* tstate = new TEST_STATE;
+	memcpy(&tstate->Depth, data, sizeof(int));
+	return tstate;
 }
 
 bool TEST_SIMULATOR::Step(STATE& state, int action,
-	int& observation, double& reward) const
+	int& observation, std::vector<double>& reward) const
 {
 	// Up to MaxDepth action 0 is good independent of observations
 	TEST_STATE& tstate = safe_cast<TEST_STATE&>(state);
-	if (tstate.Depth < MaxDepth && action == 0)
-		reward = 1.0;
-	else
-		reward = 0.0;
+	reward.assign(NumObjectives, tstate.Depth < MaxDepth && action == 0 ? 1.0 : 0.0);
 
 	observation = Random(0, GetNumObservations());
 	tstate.Depth++;
@@ -24,9 +24,12 @@ public:
 
 	virtual STATE* CreateStartState() const;
 	virtual bool Step(STATE& state, int action,
-		int& observation, double& reward) const;
+		int& observation, std::vector<double>& reward) const;
 	virtual STATE* Copy(const STATE& state) const;
 	virtual void FreeState(STATE* state) const;
+	virtual int GetPackedSize() const;
+	virtual void PackState(const STATE& state, char* data) const;
+	virtual STATE* UnpackState(const char* data) const;
 
 	double OptimalValue() const;
 	double MeanValue() const;
@@ -3,6 +3,8 @@
 namespace UTILS
 {
 
+	thread_local unsigned int* ThreadSeed = 0;
+
 	void UnitTest()
 	{
 		assert(Sign(+10) == +1);
@@ -9,6 +9,7 @@
 #include "memorypool.h"
 #include <algorithm>
 #include <numeric>
+#include <atomic>
 
 #define LargeInteger 1000000
 #define Infinity 1e+10
@@ -69,19 +70,48 @@ namespace UTILS
 		return (x > 0) - (x < 0);
 	}
 
+	// Per-thread random stream, set by RANDOM_STREAM.
+	// Threads without one share the global rand() stream
+	extern thread_local unsigned int* ThreadSeed;
+
+	class RANDOM_STREAM
+	{
+	public:
+
+		RANDOM_STREAM(unsigned int seed)
+			: Seed(seed)
+		{
+			ThreadSeed = &Seed;
+		}
+
+		~RANDOM_STREAM()
+		{
+			ThreadSeed = 0;
+		}
+
+	private:
+
+		unsigned int Seed;
+	};
+
+	inline int RandomInt()
+	{
+		return ThreadSeed ? rand_r(ThreadSeed) : rand();
+	}
+
 	inline int Random(int max)
 	{
-		return rand() % max;
+		return RandomInt() % max;
 	}
 
 	inline int Random(int min, int max)
 	{
-		return rand() % (max - min) + min;
+		return RandomInt() % (max - min) + min;
 	}
 
 	inline double RandomDouble(double min, double max)
 	{
-		return (double)rand() / RAND_MAX * (max - min) + min;
+		return (double)RandomInt() / RAND_MAX * (max - min) + min;
 	}
 
 	inline void RandomSeed(int seed)
@@ -91,7 +121,15 @@ namespace UTILS
 
 	inline bool Bernoulli(double p)
 	{
-		return rand() < p * RAND_MAX;
+		return RandomInt() < p * RAND_MAX;
+	}
+
+	inline void AtomicAdd(std::atomic<double>& total, double value)
+	{
+		double current = total.load(std::memory_order_relaxed);
+		while (!total.compare_exchange_weak(current, current + value,
+			std::memory_order_relaxed))
+			;
 	}
 
 	inline bool Near(double x, double y, double tol)